@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <capture.h>
+
+using namespace std;
+
+namespace
+{
+    constexpr size_t FLUSH_SIZE = 64 * 1024;
+} // namespace
+
+uint64_t CaptureWriter::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CaptureWriter::CaptureWriter(const char *filename, bool payload)
+    : m_file(open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)),
+      m_payload(payload)
+{
+    m_buffer.reserve(2 * FLUSH_SIZE);
+    record(CaptureRecord::Type::START, 0);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    flush();
+}
+
+void CaptureWriter::record(CaptureRecord::Type type, uint64_t connection, uint32_t size /* = 0*/,
+                           const char *payload /* = nullptr*/, uint64_t timeNs /* = 0*/)
+{
+    CaptureRecord r{};
+    r.timeNs = timeNs ? timeNs : now();
+    r.connection = connection;
+    r.size = size;
+    r.type = type;
+    if (m_payload && payload && type == CaptureRecord::Type::DATA)
+        r.flags = CaptureRecord::PAYLOAD;
+
+    const char *p = reinterpret_cast<const char *>(&r);
+    m_buffer.insert(m_buffer.end(), p, p + sizeof(r));
+    if (r.flags & CaptureRecord::PAYLOAD)
+        m_buffer.insert(m_buffer.end(), payload, payload + size);
+
+    if (m_buffer.size() >= FLUSH_SIZE)
+        flush();
+}
+
+bool CaptureWriter::flush()
+{
+    // one write per batch keeps records of concurrent writers apart
+    const char *p = m_buffer.data();
+    size_t size = m_buffer.size();
+    while (size > 0)
+    {
+        const ssize_t num = write(m_file, p, size);
+        if (-1 == num)
+        {
+            if (errno == EINTR)
+                continue;
+
+            m_buffer.clear();
+            return false;
+        }
+
+        p += num;
+        size -= num;
+    }
+
+    m_buffer.clear();
+    return true;
+}
+
+CaptureReader::CaptureReader(const char *filename) : m_file(open(filename, O_RDONLY | O_CLOEXEC))
+{
+}
+
+bool CaptureReader::next(CaptureRecord &record, std::vector<char> &payload)
+{
+    if (!read(&record, sizeof(record)))
+        return false;
+
+    payload.resize((record.flags & CaptureRecord::PAYLOAD) ? record.size : 0);
+    if (!read(payload.data(), payload.size()))
+        throw runtime_error("Truncated capture record");
+
+    return true;
+}
+
+bool CaptureReader::read(void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0)
+    {
+        if (m_offset == m_buffer.size())
+        {
+            m_buffer.resize(FLUSH_SIZE);
+            const ssize_t num = ::read(m_file, m_buffer.data(), m_buffer.size());
+            if (-1 == num)
+                throw runtime_error("Failed to read capture");
+
+            m_buffer.resize(num);
+            m_offset = 0;
+            if (0 == num)
+                return false;
+        }
+
+        const size_t chunk = min(size, m_buffer.size() - m_offset);
+        memcpy(p, m_buffer.data() + m_offset, chunk);
+        m_offset += chunk;
+        p += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <helpers/helpers.hpp>
+
+// Append-only traffic capture: fixed-size records in host byte order, DATA
+// records optionally followed by the payload. Several server instances (e.g.
+// around hot restart) may append to the same file, every one starts with START.
+struct CaptureRecord
+{
+    enum class Type : uint8_t
+    {
+        START,
+        OPEN,
+        // bytes read from the client in one burst (up to half of turn-budget), stamped
+        // when the first read of the burst returned
+        DATA,
+        // the burst is written back
+        ECHOED,
+        CLOSE,
+    };
+
+    enum Flags : uint8_t
+    {
+        PAYLOAD = 1,
+    };
+
+    // wall clock, comparable between instances
+    uint64_t timeNs;
+    uint64_t connection;
+    uint32_t size;
+    Type type;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+class CaptureWriter
+{
+public:
+    // throws if the file cannot be opened
+    CaptureWriter(const char *filename, bool payload);
+
+    CaptureWriter(const CaptureWriter &w) = delete;
+    const CaptureWriter &operator=(const CaptureWriter &w) = delete;
+
+    ~CaptureWriter();
+
+    // timeNs 0 stamps the record with now()
+    void record(CaptureRecord::Type type, uint64_t connection, uint32_t size = 0, const char *payload = nullptr,
+                uint64_t timeNs = 0);
+    // wall clock in ns as records are stamped
+    static uint64_t now();
+    // records are buffered, written with single append
+    bool flush();
+
+private:
+    FD m_file;
+    bool m_payload;
+    std::vector<char> m_buffer;
+};
+
+class CaptureReader
+{
+public:
+    // throws if the file cannot be opened
+    explicit CaptureReader(const char *filename);
+
+    // false at the end of file, payload is empty unless recorded
+    bool next(CaptureRecord &record, std::vector<char> &payload);
+
+private:
+    FD m_file;
+    std::vector<char> m_buffer;
+    size_t m_offset = 0;
+
+    bool read(void *data, size_t size);
+};
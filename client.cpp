@@ -29,7 +29,7 @@ int main(int argc, char *argv[])
     }
 
     std::unique_ptr<Logger> logger = LoggerFactory::getConsoleLogger(Logger::Level::INFO);
-    Client client(*logger);
+    Client client(*logger, INTEGRITY_CHECK);
 
     if ((argc == 2 && !client.connect(PORT)) ||
         (argc == 3 && !client.connect(argv[2], PORT)))
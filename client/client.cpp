@@ -2,10 +2,13 @@
 #include <netinet/in.h>
 #include <string.h>
 
+#include <crc32c/crc32c.h>
+
 #include "config.h"
 #include "client.h"
 
-Client::Client(Logger &logger) : Socket(AF_INET, SOCK_STREAM, 0), m_logger(logger), m_connected(false)
+Client::Client(Logger &logger, bool checksum /* = false*/)
+    : Socket(AF_INET, SOCK_STREAM, 0), m_logger(logger), m_checksum(checksum), m_connected(false)
 {
 }
 
@@ -32,7 +35,11 @@ bool Client::send(const char *msg)
         return false;
 
     // send terminating 0 as well to be able to send empty string
-    ssize_t num = write(*this, static_cast<const void *>(msg), strlen(msg) + 1);
+    std::vector<char> data(msg, msg + strlen(msg) + 1);
+    if (m_checksum)
+        appendTrailer(data, Crc32c::compute(data.data(), data.size()));
+
+    ssize_t num = write(*this, static_cast<const void *>(data.data()), data.size());
     if (-1 == num)
     {
         m_logger.log(Logger::Level::ERROR, "Failed to write to socket");
@@ -49,6 +56,8 @@ bool Client::receive(std::string &msg, size_t expectedSize)
 
     // account for terminating 0
     ++expectedSize;
+    if (m_checksum)
+        expectedSize += TRAILER_SIZE;
     std::vector<char> data;
     data.reserve(expectedSize);
 
@@ -71,10 +80,33 @@ bool Client::receive(std::string &msg, size_t expectedSize)
         data.insert(data.end(), buffer, buffer + num);
     }
 
+    if (m_checksum)
+    {
+        const size_t size = data.size() - TRAILER_SIZE;
+        uint32_t trailer = 0;
+        for (size_t i = 0; i < TRAILER_SIZE; ++i)
+            trailer |= static_cast<uint32_t>(static_cast<uint8_t>(data[size + i])) << (8 * i);
+
+        if (trailer != Crc32c::compute(data.data(), size))
+        {
+            m_logger.log(Logger::Level::ERROR, "Checksum mismatch");
+            return false;
+        }
+
+        data.resize(size);
+    }
+
     msg.assign(data.begin(), data.end() - 1);
     return true;
 }
 
+void Client::appendTrailer(std::vector<char> &data, uint32_t crc)
+{
+    // little-endian
+    for (size_t i = 0; i < TRAILER_SIZE; ++i)
+        data.push_back(static_cast<char>(crc >> (8 * i)));
+}
+
 bool Client::checkConnected() const
 {
     if (!m_connected)
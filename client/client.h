@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include <netinet/in.h>
 
@@ -10,7 +12,8 @@
 class Client : public Socket
 {
 public:
-    explicit Client(Logger &logger);
+    // with checksum every message is followed by its CRC32C and reply is verified
+    explicit Client(Logger &logger, bool checksum = false);
 
     bool connect(const char *server, int port);
     bool connect(int port);
@@ -18,9 +21,13 @@ public:
     bool receive(std::string &msg, size_t expectedSize);
 
 private:
+    static constexpr size_t TRAILER_SIZE = sizeof(uint32_t);
+
     Logger &m_logger;
+    bool m_checksum;
     bool m_connected;
 
+    static void appendTrailer(std::vector<char> &data, uint32_t crc);
     bool checkConnected() const;
     bool connect(const in_addr_t address, int port);
 };
@@ -1,3 +1,7 @@
 #pragma once
 
 #define PORT 5000
+// every 0-terminated message is followed by its CRC32C, must match server
+#ifndef INTEGRITY_CHECK
+#define INTEGRITY_CHECK 0
+#endif
@@ -4,6 +4,7 @@
 #include <memory>
 #include <shared_mutex>
 #include <thread>
+#include <vector>
 
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +15,7 @@
 
 #include "server_config.h"
 #include <client/config.h>
+#include <config/config.h>
 
 namespace {
     Logger& getLogger()
@@ -24,7 +26,7 @@ namespace {
 
     bool basicTest(const char *msg)
     {
-        Client cl(getLogger());
+        Client cl(getLogger(), INTEGRITY_CHECK);
         std::string reply;
 
         return cl.connect(PORT) && cl.send(msg) && cl.receive(reply, strlen(msg)) && (0 == reply.compare(msg));
@@ -32,10 +34,10 @@ namespace {
 
     bool mixedOrderTest(const char *msg1, const char *msg2)
     {
-        Client cl1(getLogger());
+        Client cl1(getLogger(), INTEGRITY_CHECK);
         std::string reply1;
 
-        Client cl2(getLogger());
+        Client cl2(getLogger(), INTEGRITY_CHECK);
         std::string reply2;
 
         return cl1.connect(PORT) && cl1.send(msg1) &&
@@ -65,7 +67,7 @@ bool test3()
 bool test4()
 {
     // multiple to both buffers
-    std::string msg(SERVER_BUFFEER_SIZE * CLIENT_BUFFER_SIZE, 'B');
+    std::string msg(ServerConfig().bufferSize * CLIENT_BUFFER_SIZE, 'B');
     return basicTest(msg.c_str());
 }
 
@@ -91,12 +93,13 @@ bool test7()
 bool test8()
 {
     std::atomic<bool> result{true};
-    std::array<std::thread, MAX_CONN> conns;
+    // as many clients connecting at once as the default backlog holds
+    std::vector<std::thread> conns(ServerConfig().backlog);
 
     for (size_t i = 0; i < conns.size(); ++i)
     {
         conns[i] = std::thread([i, &result]() {
-            std::string msg(10, 'A' + i);
+            std::string msg(10, 'A' + i % 26);
             if (!basicTest(msg.c_str()))
                 result = false;
         });
@@ -108,6 +111,19 @@ bool test8()
     return result;
 }
 
+bool test9()
+{
+    if (!INTEGRITY_CHECK)
+        return true;
+
+    // message with wrong checksum is not echoed, connection is closed instead
+    Client cl(getLogger());
+    const char msg[] = "hello\0\x01\x02\x03\x04";
+    char reply = 0;
+
+    return cl.connect(PORT) && (sizeof(msg) - 1) == write(cl, msg, sizeof(msg) - 1) && 0 == read(cl, &reply, 1);
+}
+
 /*bool testVeryLong()
 {
     // even longer
@@ -130,6 +146,7 @@ int main ()
     TEST(test6);
     TEST(test7);
     TEST(test8);
+    TEST(test9);
 
     return 0;
 }
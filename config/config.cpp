@@ -0,0 +1,261 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+#include <sched.h>
+
+#include <config.h>
+
+using namespace std;
+
+namespace
+{
+    struct Setting
+    {
+        const char *name;
+        const char *description;
+        // applied to the running server on SIGHUP
+        bool reloadable;
+        // throws invalid_argument
+        function<void(ServerConfig &, const string &)> set;
+        function<string(const ServerConfig &)> get;
+    };
+
+    [[noreturn]] void invalid(const string &name, const string &value, const string &expected)
+    {
+        throw invalid_argument("invalid value '" + value + "' of " + name + ", expected " + expected);
+    }
+
+    template <typename T>
+    Setting number(const char *name, const char *description, const bool reloadable, T ServerConfig::*field,
+                   const long long min, const long long max)
+    {
+        return {name, description, reloadable,
+                [=](ServerConfig &c, const string &value)
+                {
+                    errno = 0;
+                    char *end = nullptr;
+                    const long long v = strtoll(value.c_str(), &end, 10);
+                    if (value.empty() || *end || errno || v < min || v > max)
+                        invalid(name, value, "number from " + to_string(min) + " to " + to_string(max));
+                    c.*field = static_cast<T>(v);
+                },
+                [=](const ServerConfig &c)
+                { return to_string(c.*field); }};
+    }
+
+    Setting flag(const char *name, const char *description, const bool reloadable, bool ServerConfig::*field)
+    {
+        return {name, description, reloadable,
+                [=](ServerConfig &c, const string &value)
+                {
+                    if (value == "1" || value == "true" || value == "on")
+                        c.*field = true;
+                    else if (value == "0" || value == "false" || value == "off")
+                        c.*field = false;
+                    else
+                        invalid(name, value, "true or false");
+                },
+                [=](const ServerConfig &c)
+                { return string(c.*field ? "true" : "false"); }};
+    }
+
+    Setting text(const char *name, const char *description, const bool reloadable, string ServerConfig::*field,
+                 const bool allowEmpty)
+    {
+        return {name, description, reloadable,
+                [=](ServerConfig &c, const string &value)
+                {
+                    if (value.empty() && !allowEmpty)
+                        invalid(name, value, "non-empty string");
+                    c.*field = value;
+                },
+                [=](const ServerConfig &c)
+                { return c.*field; }};
+    }
+
+    Setting level(const char *name, const char *description, const bool reloadable, Logger::Level ServerConfig::*field)
+    {
+        static const pair<const char *, Logger::Level> levels[] = {
+            {"error", Logger::Level::ERROR},
+            {"info", Logger::Level::INFO},
+            {"debug", Logger::Level::DEBUG},
+        };
+
+        return {name, description, reloadable,
+                [=](ServerConfig &c, const string &value)
+                {
+                    for (const auto &l : levels)
+                    {
+                        if (value == l.first)
+                        {
+                            c.*field = l.second;
+                            return;
+                        }
+                    }
+                    invalid(name, value, "error, info or debug");
+                },
+                [=](const ServerConfig &c)
+                {
+                    for (const auto &l : levels)
+                    {
+                        if (c.*field == l.second)
+                            return string(l.first);
+                    }
+                    return string();
+                }};
+    }
+
+    const vector<Setting> &getSettings()
+    {
+        constexpr long long MAX_BUFFER = 64 * 1024 * 1024;
+        static const vector<Setting> settings = {
+            number("port", "TCP port to listen on", false, &ServerConfig::port, 1, 65535),
+            number("backlog", "listen backlog, capped by net.core.somaxconn", false, &ServerConfig::backlog, 1, INT_MAX),
+            number("max-events", "events returned by single epoll_wait", false, &ServerConfig::maxEvents, 1, 64 * 1024),
+            number("buffer-size", "bytes a read may spill past the receive buffer of a connection", true, &ServerConfig::bufferSize, 1, MAX_BUFFER),
+            number("turn-budget", "bytes a connection may move per turn before others run", true,
+                   &ServerConfig::turnBudget, 1, MAX_BUFFER),
+            level("log-level", "error, info or debug", true, &ServerConfig::logLevel),
+            text("log-file", "log file, - for console", false, &ServerConfig::logFile, false),
+            number("reactor-cpu", "CPU the event loop is pinned to, -1 for none", false, &ServerConfig::reactorCpu, -1,
+                   CPU_SETSIZE - 1),
+            flag("busy-poll", "spin instead of blocking in epoll_wait", false, &ServerConfig::busyPoll),
+            number("busy-poll-usec", "SO_BUSY_POLL of client sockets", false, &ServerConfig::busyPollUsec, 1, 1000 * 1000),
+            flag("zero-copy", "send large echoes with MSG_ZEROCOPY", false, &ServerConfig::zeroCopy),
+            number("zero-copy-threshold", "smallest echo sent with MSG_ZEROCOPY", true, &ServerConfig::zeroCopyThreshold,
+                   1, MAX_BUFFER),
+            text("capture-file", "append traffic to this file, empty to disable", false, &ServerConfig::captureFile, true),
+            flag("capture-payload", "capture payload bytes as well", false, &ServerConfig::capturePayload),
+            text("handoff-socket", "unix socket for hot restart", false, &ServerConfig::handoffSocket, false),
+            flag("handoff-clients", "pass idle connections to the next instance on hot restart", false,
+                 &ServerConfig::handoffClients),
+            number("drain-timeout-ms", "time to finish echoes in flight on hot restart, the rest is closed", false,
+                   &ServerConfig::drainTimeoutMs, 0, INT_MAX),
+        };
+        return settings;
+    }
+
+    const Setting &find(const string &name)
+    {
+        for (const auto &s : getSettings())
+        {
+            if (name == s.name)
+                return s;
+        }
+
+        throw invalid_argument("unknown setting " + name);
+    }
+
+    string trim(const string &s)
+    {
+        const size_t begin = s.find_first_not_of(" \t\r");
+        if (begin == string::npos)
+            return {};
+
+        return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+    }
+} // namespace
+
+ServerConfig ServerConfig::load(const vector<string> &args)
+{
+    // name and value of every flag, the file goes first whatever the order
+    vector<pair<string, string>> flags;
+    ServerConfig config;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const string &arg = args[i];
+        if (arg.compare(0, 2, "--") || arg.size() == 2)
+            throw invalid_argument("unexpected argument " + arg);
+
+        const size_t eq = arg.find('=');
+        string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+        string value;
+        if (eq != string::npos)
+            value = arg.substr(eq + 1);
+        else if (i + 1 < args.size())
+            value = args[++i];
+        else
+            throw invalid_argument("missing value of " + name);
+
+        if (name == "config")
+            config.loadFile(value);
+        else
+            flags.emplace_back(std::move(name), std::move(value));
+    }
+
+    for (const auto &f : flags)
+        config.set(f.first, f.second);
+
+    return config;
+}
+
+void ServerConfig::loadFile(const string &path)
+{
+    ifstream file(path);
+    if (!file.is_open())
+        throw invalid_argument("failed to open config file " + path);
+
+    string line;
+    for (size_t number = 1; getline(file, line); ++number)
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        const size_t eq = line.find('=');
+        if (eq == string::npos)
+            throw invalid_argument(path + ":" + to_string(number) + ": expected name = value");
+
+        try
+        {
+            set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+        }
+        catch (const invalid_argument &e)
+        {
+            throw invalid_argument(path + ":" + to_string(number) + ": " + e.what());
+        }
+    }
+}
+
+void ServerConfig::set(const string &name, const string &value)
+{
+    find(name).set(*this, value);
+}
+
+void ServerConfig::reload(const ServerConfig &other)
+{
+    for (const auto &s : getSettings())
+    {
+        if (s.reloadable)
+            s.set(*this, s.get(other));
+    }
+}
+
+vector<string> ServerConfig::restartRequired(const ServerConfig &other) const
+{
+    vector<string> names;
+    for (const auto &s : getSettings())
+    {
+        if (!s.reloadable && s.get(*this) != s.get(other))
+            names.push_back(s.name);
+    }
+
+    return names;
+}
+
+vector<string> ServerConfig::describe()
+{
+    const ServerConfig defaults;
+    vector<string> lines;
+    for (const auto &s : getSettings())
+    {
+        lines.push_back(string("--") + s.name + " (" + s.get(defaults) + ")" + (s.reloadable ? " [SIGHUP]" : "") +
+                        ": " + s.description);
+    }
+
+    return lines;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <logger/logger.h>
+
+// Server settings. Defaults below are overridden by the config file, then by
+// command line flags. The file has one "name = value" per line, # starts a
+// comment; flags are --name=value or --name value with the same names.
+// Invalid names or values throw invalid_argument naming the setting.
+struct ServerConfig
+{
+    int port = 5000;
+    // listen backlog
+    int backlog = 1024;
+    // events returned by single epoll_wait
+    size_t maxEvents = 256;
+    // overflow shared by all connections, reads spill into it past their own receive buffer, reloadable
+    size_t bufferSize = 64 * 1024;
+    // bytes a connection may read and write per turn before yielding to others, reloadable
+    size_t turnBudget = 128 * 1024;
+    // reloadable
+    Logger::Level logLevel = Logger::Level::INFO;
+    // "-" logs to console
+    std::string logFile = "server.log";
+    // CPU the event loop thread is pinned to, -1 leaves placement to the scheduler
+    int reactorCpu = -1;
+    // spin on epoll_wait instead of blocking and busy poll client sockets
+    bool busyPoll = false;
+    int busyPollUsec = 50;
+    // send echoes of at least zeroCopyThreshold bytes with MSG_ZEROCOPY, threshold is reloadable
+    bool zeroCopy = false;
+    size_t zeroCopyThreshold = 64 * 1024;
+    // append traffic of every connection to this file, disabled if empty
+    std::string captureFile;
+    bool capturePayload = false;
+    // unix socket the next instance connects to on hot restart
+    std::string handoffSocket = "server.handoff";
+    // pass idle client connections to the next instance instead of closing them
+    bool handoffClients = true;
+    // after hot restart, connections still echoing by then are closed
+    int drainTimeoutMs = 10 * 1000;
+
+    // defaults, then file given by --config, then the rest of flags
+    static ServerConfig load(const std::vector<std::string> &args);
+
+    void loadFile(const std::string &path);
+    void set(const std::string &name, const std::string &value);
+
+    // takes over values of reloadable settings
+    void reload(const ServerConfig &other);
+
+    // names of settings that differ from other and take effect only after restart
+    std::vector<std::string> restartRequired(const ServerConfig &other) const;
+
+    // name, default value and description of every setting
+    static std::vector<std::string> describe();
+};
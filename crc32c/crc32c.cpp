@@ -0,0 +1,256 @@
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include <crc32c.h>
+
+using namespace std;
+
+namespace
+{
+    // Castagnoli polynomial, bit-reflected
+    constexpr uint32_t POLY = 0x82F63B78;
+
+    using KernelFn = uint32_t (*)(uint32_t crc, const uint8_t *data, size_t size);
+
+    // crc32 has latency of 3 cycles and throughput of 1, three independent streams keep it busy
+    constexpr size_t BLOCK = 512;
+
+    struct Tables
+    {
+        uint32_t t[8][256];
+    };
+
+    Tables makeTables()
+    {
+        Tables tables{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+            tables.t[0][i] = c;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+                tables.t[k][i] = (tables.t[k - 1][i] >> 8) ^ tables.t[0][tables.t[k - 1][i] & 0xff];
+        }
+
+        return tables;
+    }
+
+    const Tables &getTables()
+    {
+        static const Tables tables = makeTables();
+        return tables;
+    }
+
+    // slicing-by-8, expects little-endian CPU
+    uint32_t scalar(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const auto &t = getTables().t;
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 7); --size)
+            crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t v;
+            memcpy(&v, data, sizeof(v));
+            v ^= crc;
+            crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+                  t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+        }
+
+        for (; size > 0; --size)
+            crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    // a * b mod POLY, both bit-reflected
+    uint32_t multModP(uint32_t a, uint32_t b)
+    {
+        if (0 == a)
+            return 0;
+
+        uint32_t m = 1u << 31;
+        uint32_t p = 0;
+        while (1)
+        {
+            if (a & m)
+            {
+                p ^= b;
+                if (0 == (a & (m - 1)))
+                    break;
+            }
+
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ POLY : b >> 1;
+        }
+
+        return p;
+    }
+
+    // x^n mod POLY, bit-reflected
+    uint32_t xPowNModP(size_t n)
+    {
+        uint32_t p = 1u << 31;
+        uint32_t base = 1u << 30;
+        for (; n > 0; n >>= 1)
+        {
+            if (n & 1)
+                p = multModP(base, p);
+            base = multModP(base, base);
+        }
+
+        return p;
+    }
+
+    __attribute__((target("sse4.2"))) uint32_t sse42(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 7); --size)
+            crc = _mm_crc32_u8(crc, *data++);
+
+        uint64_t c = crc;
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t v;
+            memcpy(&v, data, sizeof(v));
+            c = _mm_crc32_u64(c, v);
+        }
+        crc = static_cast<uint32_t>(c);
+
+        for (; size > 0; --size)
+            crc = _mm_crc32_u8(crc, *data++);
+
+        return crc;
+    }
+
+    // crc * x^(8 * bytes): clmul by x^(8 * bytes - 33) gives 64-bit product which
+    // crc32 instruction reduces multiplying by x^32, one more x comes from reflection
+    uint64_t shiftConstant(const size_t bytes)
+    {
+        return xPowNModP(8 * bytes - 33);
+    }
+
+    __attribute__((target("sse4.2,pclmul"))) uint32_t shift(const uint32_t crc, const uint64_t k)
+    {
+        const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                                                     _mm_cvtsi64_si128(static_cast<long long>(k)), 0x00);
+        return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+    }
+
+    __attribute__((target("sse4.2,pclmul"))) uint32_t sse42Pclmul(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        static const uint64_t shift1 = shiftConstant(BLOCK);
+        static const uint64_t shift2 = shiftConstant(2 * BLOCK);
+
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 7); --size)
+            crc = _mm_crc32_u8(crc, *data++);
+
+        for (; size >= 3 * BLOCK; size -= 3 * BLOCK, data += 3 * BLOCK)
+        {
+            uint64_t a = crc;
+            uint64_t b = 0;
+            uint64_t c = 0;
+            for (size_t i = 0; i < BLOCK; i += 8)
+            {
+                uint64_t va, vb, vc;
+                memcpy(&va, data + i, sizeof(va));
+                memcpy(&vb, data + BLOCK + i, sizeof(vb));
+                memcpy(&vc, data + 2 * BLOCK + i, sizeof(vc));
+                a = _mm_crc32_u64(a, va);
+                b = _mm_crc32_u64(b, vb);
+                c = _mm_crc32_u64(c, vc);
+            }
+
+            crc = shift(static_cast<uint32_t>(a), shift2) ^ shift(static_cast<uint32_t>(b), shift1) ^
+                  static_cast<uint32_t>(c);
+        }
+
+        return sse42(crc, data, size);
+    }
+#endif
+
+    KernelFn getKernel(const Crc32c::Kernel kernel)
+    {
+        if (!Crc32c::isSupported(kernel))
+            throw invalid_argument("CRC32C kernel is not supported by CPU");
+
+        switch (kernel)
+        {
+#if defined(__x86_64__)
+        case Crc32c::Kernel::SSE42:
+            return sse42;
+        case Crc32c::Kernel::SSE42_PCLMUL:
+            return sse42Pclmul;
+#endif
+        default:
+            return scalar;
+        }
+    }
+} // namespace
+
+uint32_t Crc32c::compute(const void *data, size_t size, uint32_t crc /* = 0*/)
+{
+    static const KernelFn kernel = getKernel(selected());
+    // data shorter than three blocks never reaches the interleaved streams
+    static const KernelFn shortKernel =
+        getKernel(selected() == Kernel::SSE42_PCLMUL ? Kernel::SSE42 : selected());
+    return ~(size < 3 * BLOCK ? shortKernel : kernel)(~crc, static_cast<const uint8_t *>(data), size);
+}
+
+uint32_t Crc32c::compute(Crc32c::Kernel kernel, const void *data, size_t size, uint32_t crc /* = 0*/)
+{
+    return ~getKernel(kernel)(~crc, static_cast<const uint8_t *>(data), size);
+}
+
+bool Crc32c::isSupported(Crc32c::Kernel kernel)
+{
+    switch (kernel)
+    {
+    case Kernel::SCALAR:
+        return true;
+#if defined(__x86_64__)
+    case Kernel::SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case Kernel::SSE42_PCLMUL:
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+#endif
+    default:
+        return false;
+    }
+}
+
+Crc32c::Kernel Crc32c::selected()
+{
+    if (isSupported(Kernel::SSE42_PCLMUL))
+        return Kernel::SSE42_PCLMUL;
+
+    if (isSupported(Kernel::SSE42))
+        return Kernel::SSE42;
+
+    return Kernel::SCALAR;
+}
+
+const char *Crc32c::name(Crc32c::Kernel kernel)
+{
+    switch (kernel)
+    {
+    case Kernel::SCALAR:
+        return "scalar";
+    case Kernel::SSE42:
+        return "sse4.2";
+    case Kernel::SSE42_PCLMUL:
+        return "sse4.2+pclmul";
+    default:
+        return "unknown";
+    }
+}
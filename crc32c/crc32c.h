@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) with the kernel chosen at runtime by CPU features, data
+// too short for the interleaved kernel goes to the single stream one.
+// compute() takes the result of the previous call to checksum data in pieces.
+class Crc32c
+{
+public:
+    enum class Kernel
+    {
+        SCALAR,
+        // crc32 instruction, single stream
+        SSE42,
+        // three interleaved crc32 streams combined with carry-less multiplication
+        SSE42_PCLMUL,
+    };
+
+    static uint32_t compute(const void *data, size_t size, uint32_t crc = 0);
+    static uint32_t compute(Kernel kernel, const void *data, size_t size, uint32_t crc = 0);
+
+    static bool isSupported(Kernel kernel);
+    static Kernel selected();
+    static const char *name(Kernel kernel);
+};
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crc32c/crc32c.h>
+
+// Checks every CRC32C kernel supported by the CPU against the scalar one and
+// measures its throughput for frames of different sizes, then the same for the
+// kernel dispatched by compute() by data size.
+
+namespace
+{
+    constexpr Crc32c::Kernel kernels[] = {
+        Crc32c::Kernel::SCALAR,
+        Crc32c::Kernel::SSE42,
+        Crc32c::Kernel::SSE42_PCLMUL,
+    };
+
+    // compute(data, size, crc) of one kernel or of the dispatching one
+    template <typename Compute>
+    bool verify(const Compute &compute)
+    {
+        // check value of the CRC32C catalogue
+        const char *check = "123456789";
+        if (0xE3069283 != compute(check, strlen(check), 0))
+            return false;
+
+        std::mt19937 rng(42);
+        std::vector<char> data(64 * 1024);
+        for (auto &c : data)
+            c = static_cast<char>(rng());
+
+        // unaligned starts, sizes around block boundaries, computed in one piece and in two
+        for (size_t offset = 0; offset < 8; ++offset)
+        {
+            for (size_t size = 0; size + offset <= data.size(); size = size * 3 / 2 + 1)
+            {
+                const char *p = data.data() + offset;
+                const uint32_t expected = Crc32c::compute(Crc32c::Kernel::SCALAR, p, size);
+                const size_t half = size / 2;
+                if (expected != compute(p, size, 0) || expected != compute(p + half, size - half, compute(p, half, 0)))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename Compute>
+    double measure(const Compute &compute, const std::vector<char> &data, const size_t frame)
+    {
+        // about 1 GiB worth of frames
+        const size_t rounds = std::max<size_t>(1, (1024 * 1024 * 1024) / data.size());
+        uint32_t crc = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r)
+        {
+            for (size_t pos = 0; pos + frame <= data.size(); pos += frame)
+                crc ^= compute(data.data() + pos, frame, 0);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        // keep the result alive
+        if (crc == 0x12345678)
+            printf(" ");
+
+        return static_cast<double>(rounds * (data.size() / frame) * frame) / elapsed.count() / 1e9;
+    }
+} // namespace
+
+int main()
+{
+    printf("selected kernel: %s\n", Crc32c::name(Crc32c::selected()));
+
+    const std::vector<char> data(1024 * 1024, 'x');
+    const size_t frames[] = {64, 1024, 16 * 1024, 1024 * 1024};
+
+    bool result = true;
+    const auto run = [&](const char *name, const auto &compute)
+    {
+        if (!verify(compute))
+        {
+            printf("%-14s FAIL: wrong checksum\n", name);
+            result = false;
+            return;
+        }
+
+        printf("%-14s", name);
+        for (const size_t frame : frames)
+            printf("  %7zu B: %6.2f GB/s", frame, measure(compute, data, frame));
+        printf("\n");
+    };
+
+    for (const auto kernel : kernels)
+    {
+        if (!Crc32c::isSupported(kernel))
+        {
+            printf("%-14s not supported\n", Crc32c::name(kernel));
+            continue;
+        }
+
+        run(Crc32c::name(kernel), [kernel](const void *p, const size_t size, const uint32_t crc)
+            { return Crc32c::compute(kernel, p, size, crc); });
+    }
+
+    run("dispatched", [](const void *p, const size_t size, const uint32_t crc)
+        { return Crc32c::compute(p, size, crc); });
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <client/client.h>
+#include <logger/logger.h>
+
+#include "client_config.h"
+
+// Mixed workload: small clients ping the server and measure round trip latency
+// while large clients keep streaming big messages through it.
+
+namespace
+{
+    Logger &getLogger()
+    {
+        static std::unique_ptr<Logger> l = LoggerFactory::getConsoleLogger(Logger::Level::ERROR);
+        return *l;
+    }
+
+    // no progress for that long fails the run
+    constexpr int IO_TIMEOUT_MS = 30 * 1000;
+
+    // sends the message while reading the echo of it, a message larger than socket
+    // buffers on both sides would block client and server on each other otherwise
+    bool exchange(const int fd, const std::vector<char> &msg, std::vector<char> &buffer)
+    {
+        size_t sent = 0;
+        size_t received = 0;
+        while (received < msg.size())
+        {
+            struct pollfd p{fd, static_cast<short>(POLLIN | (sent < msg.size() ? POLLOUT : 0)), 0};
+            if (poll(&p, 1, IO_TIMEOUT_MS) <= 0)
+                return false;
+
+            if (p.revents & POLLOUT)
+            {
+                const ssize_t num = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+                if (-1 == num && errno != EAGAIN)
+                    return false;
+                sent += std::max<ssize_t>(num, 0);
+            }
+
+            if (p.revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                const ssize_t num = read(fd, buffer.data(), buffer.size());
+                if (-1 == num && errno == EAGAIN)
+                    continue;
+                if (num <= 0)
+                    return false;
+                received += num;
+            }
+        }
+
+        return true;
+    }
+
+    void smallClient(const std::atomic<bool> &stop, std::vector<double> &latencies, std::atomic<bool> &result)
+    {
+        Client cl(getLogger(), INTEGRITY_CHECK);
+        if (!cl.connect(PORT))
+        {
+            result = false;
+            return;
+        }
+
+        const std::string msg(64, 'S');
+        std::string reply;
+        while (!stop)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            if (!cl.send(msg.c_str()) || !cl.receive(reply, msg.size()) || 0 != reply.compare(msg))
+            {
+                result = false;
+                return;
+            }
+
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+    }
+
+    void largeClient(const std::atomic<bool> &stop, const size_t size, std::atomic<size_t> &bytes, std::atomic<bool> &result)
+    {
+        Client cl(getLogger());
+        if (!cl.connect(PORT) || -1 == fcntl(cl, F_SETFL, fcntl(cl, F_GETFL, 0) | O_NONBLOCK))
+        {
+            result = false;
+            return;
+        }
+
+        const std::vector<char> msg(size, 'L');
+        std::vector<char> buffer(64 * 1024);
+        while (!stop)
+        {
+            if (!exchange(cl, msg, buffer))
+            {
+                result = false;
+                return;
+            }
+
+            bytes += size;
+        }
+    }
+
+    double percentile(const std::vector<double> &sorted, const double p)
+    {
+        if (sorted.empty())
+            return 0;
+
+        const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+        return sorted[index];
+    }
+
+    void printUsage()
+    {
+        printf("echo_bench [small clients] [large clients] [seconds] [large message bytes]\n");
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 5 || (argc == 2 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))))
+    {
+        printUsage();
+        return argc > 5 ? -1 : 0;
+    }
+
+    const size_t smallClients = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+    const size_t largeClients = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2;
+    const size_t seconds = argc > 3 ? strtoul(argv[3], nullptr, 10) : 5;
+    const size_t largeSize = argc > 4 ? strtoul(argv[4], nullptr, 10) : 4 * 1024 * 1024;
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> result{true};
+    std::atomic<size_t> largeBytes{0};
+    std::vector<std::vector<double>> latencies(smallClients);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < largeClients; ++i)
+        threads.emplace_back(largeClient, std::cref(stop), largeSize, std::ref(largeBytes), std::ref(result));
+
+    for (size_t i = 0; i < smallClients; ++i)
+        threads.emplace_back(smallClient, std::cref(stop), std::ref(latencies[i]), std::ref(result));
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+
+    for (auto &t : threads)
+        t.join();
+
+    std::vector<double> all;
+    for (const auto &l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+
+    printf("small clients: %zu, large clients: %zu, large message: %zu bytes, duration: %zu s\n",
+           smallClients, largeClients, largeSize, seconds);
+    printf("small round trips: %zu, large throughput: %.1f MB/s\n",
+           all.size(), static_cast<double>(largeBytes) / (1024 * 1024) / seconds);
+    printf("small latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           percentile(all, 0.5), percentile(all, 0.99), percentile(all, 0.999), all.empty() ? 0 : all.back());
+
+    if (!result)
+    {
+        printf("FAIL: echo mismatch or connection error\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <capture/capture.h>
+#include <client/client.h>
+#include <helpers/helpers.hpp>
+#include <logger/logger.h>
+
+#include "client_config.h"
+
+// Replays traffic captured by the server (capture-file) against a local server:
+// every captured connection gets its own connection, bursts are sent at their
+// original time, scaled, or as fast as possible.
+//
+// Divergence compares the same interval in both runs: server time of a burst
+// from DATA to ECHOED, in the original capture and in the capture the server
+// records during the replay. The server has to serve the replay only, its
+// connections are matched to the replayed ones by the order they were opened
+// and bursts are compared where both runs read the same bytes as one burst.
+// Round trip measured by the replay itself includes network and client time.
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    Logger &getLogger()
+    {
+        static std::unique_ptr<Logger> l = LoggerFactory::getConsoleLogger(Logger::Level::ERROR);
+        return *l;
+    }
+
+    struct Burst
+    {
+        uint64_t timeNs;
+        // empty unless payload was captured
+        std::vector<char> payload;
+        uint32_t size;
+        // from the whole burst read to echo written on the server, 0 if the echo was not captured
+        uint64_t serverNs = 0;
+    };
+
+    struct Recorded
+    {
+        uint64_t openNs = 0;
+        uint64_t closeNs = 0;
+        std::vector<Burst> bursts;
+    };
+
+    struct Replayed
+    {
+        const Recorded *recorded;
+        std::shared_ptr<Client> client;
+        size_t next = 0;
+        bool open = false;
+        bool closed = false;
+        std::vector<char> out;
+        size_t outOffset = 0;
+        // sent and not echoed yet
+        std::deque<char> inflight;
+        // send time and bytes of every burst waiting for echo
+        std::deque<std::pair<Clock::time_point, size_t>> waiting;
+        size_t waitingBurst = 0;
+    };
+
+    // records before sinceNs are skipped, e.g. earlier runs appended to the same file
+    std::vector<Recorded> load(const char *filename, const uint64_t sinceNs = 0)
+    {
+        std::map<uint64_t, Recorded> connections;
+        std::map<uint64_t, size_t> echoed;
+        CaptureReader reader(filename);
+        CaptureRecord r{};
+        std::vector<char> payload;
+        while (reader.next(r, payload))
+        {
+            if (r.timeNs < sinceNs)
+                continue;
+
+            Recorded &conn = connections[r.connection];
+            switch (r.type)
+            {
+            case CaptureRecord::Type::OPEN:
+                conn.openNs = r.timeNs;
+                break;
+            case CaptureRecord::Type::DATA:
+                conn.bursts.push_back({r.timeNs, payload, r.size});
+                break;
+            case CaptureRecord::Type::ECHOED:
+            {
+                // every burst is echoed before the next one is read
+                size_t &i = echoed[r.connection];
+                if (i < conn.bursts.size())
+                {
+                    conn.bursts[i].serverNs = r.timeNs - conn.bursts[i].timeNs;
+                    ++i;
+                }
+                break;
+            }
+            case CaptureRecord::Type::CLOSE:
+                conn.closeNs = r.timeNs;
+                break;
+            default:
+                break;
+            }
+        }
+
+        std::vector<Recorded> result;
+        for (auto &c : connections)
+        {
+            // connections opened before the capture started have no OPEN
+            if (!c.second.openNs && !c.second.bursts.empty())
+                c.second.openNs = c.second.bursts.front().timeNs;
+
+            if (c.second.openNs)
+                result.push_back(std::move(c.second));
+        }
+
+        std::sort(result.begin(), result.end(), [](const auto &a, const auto &b)
+                  { return a.openNs < b.openNs; });
+        return result;
+    }
+
+    // same bytes are generated when payload was not captured, never 0 to keep server log sane
+    void fill(std::vector<char> &out, const Burst &burst)
+    {
+        if (!burst.payload.empty())
+        {
+            out.insert(out.end(), burst.payload.begin(), burst.payload.end());
+            return;
+        }
+
+        for (uint32_t i = 0; i < burst.size; ++i)
+            out.push_back(static_cast<char>('a' + (burst.timeNs + i) % 26));
+    }
+
+    bool flush(Replayed &conn)
+    {
+        while (conn.outOffset < conn.out.size())
+        {
+            const ssize_t num = send(*conn.client, conn.out.data() + conn.outOffset, conn.out.size() - conn.outOffset, MSG_NOSIGNAL);
+            if (-1 == num)
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+
+            conn.outOffset += num;
+        }
+
+        conn.out.clear();
+        conn.outOffset = 0;
+        return true;
+    }
+
+    // returns false on mismatch or error
+    bool receive(Replayed &conn, std::vector<double> &roundTripUs)
+    {
+        char buffer[64 * 1024];
+        while (1)
+        {
+            const ssize_t num = read(*conn.client, buffer, sizeof(buffer));
+            if (-1 == num)
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+
+            if (0 == num || static_cast<size_t>(num) > conn.inflight.size() ||
+                !std::equal(buffer, buffer + num, conn.inflight.begin()))
+                return false;
+
+            conn.inflight.erase(conn.inflight.begin(), conn.inflight.begin() + num);
+
+            // complete bursts in order
+            size_t left = num;
+            const auto now = Clock::now();
+            while (left > 0 && !conn.waiting.empty())
+            {
+                auto &w = conn.waiting.front();
+                const size_t n = std::min(left, w.second);
+                w.second -= n;
+                left -= n;
+                if (0 == w.second)
+                {
+                    ++conn.waitingBurst;
+                    const std::chrono::duration<double, std::micro> roundTrip = now - w.first;
+                    roundTripUs.push_back(roundTrip.count());
+                    conn.waiting.pop_front();
+                }
+            }
+        }
+    }
+
+    // server time of bursts both runs read as the same bytes, replayed minus recorded
+    std::vector<double> divergence(const Recorded &recorded, const Recorded &replay)
+    {
+        std::vector<double> result;
+        const auto &a = recorded.bursts;
+        const auto &b = replay.bursts;
+        size_t i = 0;
+        size_t j = 0;
+        // stream offsets where the current bursts begin
+        uint64_t startA = 0;
+        uint64_t startB = 0;
+        while (i < a.size() && j < b.size())
+        {
+            const uint64_t endA = startA + a[i].size;
+            const uint64_t endB = startB + b[j].size;
+            if (startA == startB && endA == endB && a[i].serverNs && b[j].serverNs)
+                result.push_back((static_cast<double>(b[j].serverNs) - a[i].serverNs) / 1000.0);
+
+            if (endA <= endB)
+            {
+                startA = endA;
+                ++i;
+            }
+            if (endB <= endA)
+            {
+                startB = endB;
+                ++j;
+            }
+        }
+
+        return result;
+    }
+
+    double percentile(std::vector<double> values, const double p)
+    {
+        if (values.empty())
+            return 0;
+
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+    }
+
+    void report(const char *label, const std::vector<double> &values)
+    {
+        printf("%-12s p50 %10.1f  p90 %10.1f  p99 %10.1f  max %10.1f\n", label, percentile(values, 0.5),
+               percentile(values, 0.9), percentile(values, 0.99), percentile(values, 1));
+    }
+
+    void printUsage()
+    {
+        printf("echo_replay capture_file [speed factor | max] [server ip] [capture_file of the replay]\n");
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 5 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))
+    {
+        printUsage();
+        return argc < 2 || argc > 5 ? -1 : 0;
+    }
+
+    // max: every connection sends its next burst as soon as the previous one is echoed
+    const bool max = argc > 2 && !strcmp(argv[2], "max");
+    const double speed = (argc > 2 && !max) ? atof(argv[2]) : 1.0;
+    const char *server = argc > 3 ? argv[3] : "127.0.0.1";
+    // written by the server during the replay
+    const char *replayCapture = argc > 4 ? argv[4] : nullptr;
+    if (speed <= 0)
+    {
+        printUsage();
+        return -1;
+    }
+
+    std::vector<Recorded> recorded;
+    try
+    {
+        recorded = load(argv[1]);
+    }
+    catch (const std::exception &e)
+    {
+        printf("Failed to load capture: %s\n", e.what());
+        return -1;
+    }
+
+    if (recorded.empty())
+    {
+        printf("Capture has no connections\n");
+        return -1;
+    }
+
+    const uint64_t originNs = recorded.front().openNs;
+    const uint64_t startNs = CaptureWriter::now();
+    const auto start = Clock::now();
+    const auto due = [&](const uint64_t timeNs)
+    {
+        return max ? start : start + std::chrono::nanoseconds(static_cast<uint64_t>((timeNs - originNs) / speed));
+    };
+
+    std::vector<Replayed> replayed(recorded.size());
+    for (size_t i = 0; i < recorded.size(); ++i)
+        replayed[i].recorded = &recorded[i];
+
+    // next action of every connection ordered by its time
+    using Action = std::pair<Clock::time_point, size_t>;
+    std::priority_queue<Action, std::vector<Action>, std::greater<Action>> actions;
+    for (size_t i = 0; i < recorded.size(); ++i)
+        actions.push({due(recorded[i].openNs), i});
+
+    Epoll epoll;
+    std::unordered_map<int, size_t> byFd;
+    std::vector<double> roundTripUs;
+    // recorded connections in the order the server accepted their replays
+    std::vector<size_t> opened;
+    size_t active = recorded.size();
+    bool result = true;
+    // how far behind the capture the replay fell, e.g. blocked in connect
+    Clock::duration maxLag{};
+
+    // connection can go on with its next burst or close
+    const auto schedule = [&](const size_t i)
+    {
+        Replayed &conn = replayed[i];
+        if (conn.next < conn.recorded->bursts.size())
+        {
+            if (!max || conn.waiting.empty())
+                actions.push({due(conn.recorded->bursts[conn.next].timeNs), i});
+        }
+        else if (conn.waiting.empty())
+        {
+            actions.push({due(std::max(conn.recorded->closeNs, originNs)), i});
+        }
+    };
+
+    const auto fail = [&](Replayed &conn, const char *what)
+    {
+        printf("FAIL: %s\n", what);
+        result = false;
+        if (conn.open && !conn.closed)
+        {
+            byFd.erase(*conn.client);
+            epoll.remove(*conn.client);
+        }
+        conn.closed = true;
+        --active;
+    };
+
+    struct epoll_event events[64];
+    while (active > 0)
+    {
+        // actions that are due, connect blocks so time is taken for every action
+        while (!actions.empty() && actions.top().first <= Clock::now())
+        {
+            const auto now = Clock::now();
+            const size_t i = actions.top().second;
+            maxLag = std::max(maxLag, now - actions.top().first);
+            actions.pop();
+
+            Replayed &conn = replayed[i];
+            if (conn.closed)
+                continue;
+
+            if (!conn.open)
+            {
+                conn.client = std::make_shared<Client>(getLogger());
+                if (!conn.client->connect(server, PORT) || !epoll.addNonblocking(conn.client, EPOLLIN | EPOLLOUT | EPOLLET))
+                {
+                    fail(conn, "failed to connect");
+                    continue;
+                }
+
+                // bursts are sent on time without waiting for echo, do not let Nagle batch them
+                const int noDelay = 1;
+                setsockopt(*conn.client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+                conn.open = true;
+                opened.push_back(i);
+                byFd[*conn.client] = i;
+                schedule(i);
+                continue;
+            }
+
+            if (conn.next < conn.recorded->bursts.size())
+            {
+                const Burst &burst = conn.recorded->bursts[conn.next++];
+                const size_t before = conn.out.size();
+                fill(conn.out, burst);
+                conn.inflight.insert(conn.inflight.end(), conn.out.begin() + before, conn.out.end());
+                conn.waiting.push_back({now, burst.size});
+                if (!flush(conn))
+                {
+                    fail(conn, "failed to send");
+                    continue;
+                }
+
+                schedule(i);
+                continue;
+            }
+
+            // all bursts echoed
+            byFd.erase(*conn.client);
+            epoll.remove(*conn.client);
+            conn.closed = true;
+            --active;
+        }
+
+        // last connection closed by its action, nothing to wait for
+        if (0 == active)
+            break;
+
+        int timeout = -1;
+        if (!actions.empty())
+        {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(actions.top().first - Clock::now());
+            timeout = std::max<int>(0, left.count());
+        }
+
+        const int num = epoll_wait(epoll, events, 64, timeout);
+        if (-1 == num && errno != EINTR)
+        {
+            printf("Failed to wait\n");
+            return -1;
+        }
+
+        for (int e = 0; e < num; ++e)
+        {
+            auto it = byFd.find(events[e].data.fd);
+            if (it == byFd.end())
+                continue;
+
+            const size_t i = it->second;
+            Replayed &conn = replayed[i];
+            if ((events[e].events & EPOLLOUT) && !flush(conn))
+            {
+                fail(conn, "failed to send");
+                continue;
+            }
+
+            if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                const bool waited = !conn.waiting.empty();
+                if (!receive(conn, roundTripUs))
+                {
+                    fail(conn, "reply mismatch or connection closed");
+                    continue;
+                }
+
+                // next burst waits for echo in max mode, close always waits for the last echo
+                if (waited && conn.waiting.empty() && (max || conn.next == conn.recorded->bursts.size()))
+                    schedule(i);
+            }
+        }
+    }
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const std::chrono::duration<double, std::milli> lag = maxLag;
+    printf("connections %zu, bursts %zu, replayed in %.2f s, max %.1f ms behind capture\n", recorded.size(),
+           roundTripUs.size(), elapsed.count(), max ? 0.0 : lag.count());
+
+    std::vector<double> recordedUs;
+    for (const auto &conn : recorded)
+    {
+        for (const auto &burst : conn.bursts)
+        {
+            if (burst.serverNs)
+                recordedUs.push_back(burst.serverNs / 1000.0);
+        }
+    }
+
+    printf("server us, DATA to ECHOED:\n");
+    report("recorded", recordedUs);
+    if (replayCapture)
+    {
+        std::vector<Recorded> replay;
+        try
+        {
+            // the server flushes its capture once per loop, give it the last echoes
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            replay = load(replayCapture, startNs);
+        }
+        catch (const std::exception &e)
+        {
+            printf("Failed to load capture of the replay: %s\n", e.what());
+            return -1;
+        }
+
+        if (replay.size() != opened.size())
+            printf("capture of the replay has %zu connections instead of %zu, is the server serving others?\n",
+                   replay.size(), opened.size());
+
+        std::vector<double> replayedUs;
+        for (const auto &conn : replay)
+        {
+            for (const auto &burst : conn.bursts)
+            {
+                if (burst.serverNs)
+                    replayedUs.push_back(burst.serverNs / 1000.0);
+            }
+        }
+
+        std::vector<double> divergenceUs;
+        for (size_t k = 0; k < std::min(replay.size(), opened.size()); ++k)
+        {
+            const std::vector<double> d = divergence(recorded[opened[k]], replay[k]);
+            divergenceUs.insert(divergenceUs.end(), d.begin(), d.end());
+        }
+
+        report("replayed", replayedUs);
+        report("divergence", divergenceUs);
+        printf("divergence of %zu bursts read alike in both runs\n", divergenceUs.size());
+    }
+    else
+    {
+        printf("pass capture_file of the replay for divergence\n");
+    }
+
+    printf("round trip us, replay client:\n");
+    report("round trip", roundTripUs);
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,617 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <new>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Coroutines driven by the epoll loop: a connection handler is written as a plain
+// sequence of co_await read/write/sleep_for and Scheduler resumes it when the
+// socket is ready, without a thread per connection.
+
+class Scheduler;
+
+// Coroutine frames are recycled by size class instead of going to the heap
+// for every connection. Used from the event loop thread only.
+class FramePool
+{
+public:
+    static void *allocate(const size_t size)
+    {
+        used() += roundUp(size);
+        auto &list = freeList(size);
+        if (list.empty())
+            return ::operator new(roundUp(size));
+
+        void *p = list.back();
+        list.pop_back();
+        return p;
+    }
+
+    static void deallocate(void *p, const size_t size)
+    {
+        used() -= roundUp(size);
+        freeList(size).push_back(p);
+    }
+
+    // bytes of frames of running coroutines
+    static size_t inUse()
+    {
+        return used();
+    }
+
+private:
+    static constexpr size_t GRANULARITY = 64;
+
+    static size_t roundUp(const size_t size)
+    {
+        return (size + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+    }
+
+    static size_t &used()
+    {
+        static size_t bytes = 0;
+        return bytes;
+    }
+
+    static std::vector<void *> &freeList(const size_t size)
+    {
+        static std::unordered_map<size_t, std::vector<void *>> lists;
+        return lists[roundUp(size)];
+    }
+};
+
+// syscalls and bytes of all socket operations, for metrics
+struct IoCounters
+{
+    uint64_t reads = 0;
+    uint64_t readBytes = 0;
+    uint64_t writes = 0;
+    uint64_t writeBytes = 0;
+};
+
+class IoOp
+{
+public:
+    enum class Status
+    {
+        DONE,
+        WOULD_BLOCK,
+        // budget of the turn is exhausted, let others run first
+        YIELD,
+    };
+
+    enum class Kind
+    {
+        READ,
+        WRITE,
+    };
+
+    // op that does not wait completes with -1 and errno EAGAIN instead of blocking,
+    // write with zeroCopySends sends with MSG_ZEROCOPY and counts calls that went through,
+    // read with overflow continues into it once buffer is full (readv), overflow may be
+    // resized while the op waits
+    IoOp(const int fd, const Kind kind, char *buffer, const size_t size, const bool wait = true,
+         uint32_t *zeroCopySends = nullptr, std::vector<char> *overflow = nullptr)
+        : m_fd(fd), m_kind(kind), m_buffer(buffer), m_size(size), m_wait(wait), m_zeroCopySends(zeroCopySends),
+          m_overflow(overflow) {}
+
+    static IoCounters &counters()
+    {
+        static IoCounters c;
+        return c;
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    Kind kind() const
+    {
+        return m_kind;
+    }
+
+    // bytes transferred, 0 on end of stream, -1 on error
+    ssize_t result() const
+    {
+        return m_result;
+    }
+
+    // read completes on any data, write once everything is written
+    Status attempt(size_t &budget)
+    {
+        while (1)
+        {
+            if (0 == budget)
+                return Status::YIELD;
+
+            const size_t size = std::min(m_size - m_done, budget);
+            const ssize_t num = (m_kind == Kind::READ) ? receive(size, budget - size) : transmit(size);
+            if (-1 == num)
+            {
+                // out of memory for pinning pages, rest of the buffer is copied
+                if (m_zeroCopySends && errno == ENOBUFS)
+                {
+                    m_zeroCopySends = nullptr;
+                    continue;
+                }
+
+                if (m_wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return Status::WOULD_BLOCK;
+
+                m_result = -1;
+                return Status::DONE;
+            }
+
+            if (m_zeroCopySends)
+                ++*m_zeroCopySends;
+
+            budget -= num;
+            m_done += num;
+            if (m_kind == Kind::READ || m_done == m_size)
+            {
+                m_result = m_done;
+                return Status::DONE;
+            }
+        }
+    }
+
+private:
+    int m_fd;
+    Kind m_kind;
+    char *m_buffer;
+    size_t m_size;
+    bool m_wait;
+    uint32_t *m_zeroCopySends;
+    std::vector<char> *m_overflow;
+    size_t m_done = 0;
+    ssize_t m_result = -1;
+
+    ssize_t receive(const size_t size, const size_t overflowSize)
+    {
+        ssize_t num = -1;
+        if (!m_overflow)
+        {
+            num = read(m_fd, m_buffer, size);
+        }
+        else
+        {
+            struct iovec iov[] = {{m_buffer, size}, {m_overflow->data(), std::min(m_overflow->size(), overflowSize)}};
+            num = readv(m_fd, iov, 2);
+        }
+
+        ++counters().reads;
+        counters().readBytes += std::max<ssize_t>(num, 0);
+        return num;
+    }
+
+    ssize_t transmit(const size_t size)
+    {
+        const int flags = MSG_NOSIGNAL | (m_zeroCopySends ? MSG_ZEROCOPY : 0);
+        const ssize_t num = send(m_fd, m_buffer + m_done, size, flags);
+        ++counters().writes;
+        counters().writeBytes += std::max<ssize_t>(num, 0);
+        return num;
+    }
+};
+
+class Task
+{
+public:
+    struct promise_type
+    {
+        enum class Wait
+        {
+            NONE,
+            READY,
+            FD,
+            TIMER,
+        };
+
+        Scheduler *scheduler = nullptr;
+        int id = -1;
+        // bytes left for the current turn
+        size_t budget = 0;
+        Wait wait = Wait::NONE;
+        // operation to retry when resumed from the ready queue or by the socket
+        IoOp *op = nullptr;
+        std::multimap<std::chrono::steady_clock::time_point, std::coroutine_handle<promise_type>>::iterator timer;
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        static void *operator new(const size_t size)
+        {
+            return FramePool::allocate(size);
+        }
+
+        static void operator delete(void *p, const size_t size)
+        {
+            FramePool::deallocate(p, size);
+        }
+    };
+
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(Handle h) : m_handle(h) {}
+
+    Task(const Task &t) = delete;
+    const Task &operator=(const Task &t) = delete;
+
+    Task(Task &&t) noexcept : m_handle(std::exchange(t.m_handle, nullptr)) {}
+
+    Task &operator=(Task &&t) noexcept
+    {
+        if (this != &t)
+        {
+            release();
+            m_handle = std::exchange(t.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        release();
+    }
+
+    Handle handle() const
+    {
+        return m_handle;
+    }
+
+private:
+    Handle m_handle;
+
+    inline void release();
+};
+
+class Scheduler
+{
+public:
+    using Handle = Task::Handle;
+    using Clock = std::chrono::steady_clock;
+    using Wait = Task::promise_type::Wait;
+
+    explicit Scheduler(const size_t budget) : m_budget(budget) {}
+
+    Scheduler(const Scheduler &s) = delete;
+    const Scheduler &operator=(const Scheduler &s) = delete;
+
+    // bytes every coroutine may transfer per turn from the next turn on
+    void setBudget(const size_t budget)
+    {
+        m_budget = budget;
+    }
+
+    // called with id of every coroutine that ran to completion
+    void onFinished(std::function<void(int)> callback)
+    {
+        m_onFinished = std::move(callback);
+    }
+
+    void spawn(Task &task, const int id)
+    {
+        Handle h = task.handle();
+        h.promise().scheduler = this;
+        h.promise().id = id;
+        post(h);
+    }
+
+    // epoll_wait timeout in ms: do not block while there is work or a timer is due
+    int timeout() const
+    {
+        if (!m_ready.empty())
+            return 0;
+
+        if (m_timers.empty())
+            return -1;
+
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(m_timers.begin()->first - Clock::now());
+        return std::max<int>(0, left.count());
+    }
+
+    // socket events, wakes coroutines waiting on the fd
+    void notify(const int fd, const uint32_t events)
+    {
+        auto it = m_parked.find(fd);
+        if (it == m_parked.end())
+            return;
+
+        Parked &p = it->second;
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && p.reader)
+            post(std::exchange(p.reader, nullptr));
+
+        if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && p.writer)
+            post(std::exchange(p.writer, nullptr));
+
+        if (!p.reader && !p.writer)
+            m_parked.erase(it);
+    }
+
+    // one turn for every coroutine ready now, rescheduled ones wait for next round
+    void run()
+    {
+        const auto now = Clock::now();
+        while (!m_timers.empty() && m_timers.begin()->first <= now)
+        {
+            Handle h = m_timers.begin()->second;
+            m_timers.erase(m_timers.begin());
+            post(h);
+        }
+
+        for (size_t n = m_ready.size(); n > 0 && !m_ready.empty(); --n)
+        {
+            Handle h = m_ready.front();
+            m_ready.pop_front();
+
+            auto &p = h.promise();
+            p.wait = Wait::NONE;
+            p.budget = m_budget;
+            if (p.op && !complete(h, *p.op))
+                continue;
+
+            p.op = nullptr;
+            h.resume();
+            if (h.done() && m_onFinished)
+                m_onFinished(p.id);
+        }
+    }
+
+    // bookkeeping of a parked connection: its hash node and bucket
+    static constexpr size_t parkedBytes()
+    {
+        return sizeof(std::unordered_map<int, Parked>::value_type) + 2 * sizeof(void *);
+    }
+
+    // coroutine suspended reading its socket has nothing in flight
+    bool isWaitingToRead(const int fd) const
+    {
+        auto it = m_parked.find(fd);
+        return it != m_parked.end() && it->second.reader && !it->second.writer;
+    }
+
+    // awaiters
+
+    bool suspend(Handle h, IoOp &op)
+    {
+        auto &p = h.promise();
+        p.op = &op;
+        if (!complete(h, op))
+            return true;
+
+        p.op = nullptr;
+        return false;
+    }
+
+    void sleep(Handle h, const Clock::time_point deadline)
+    {
+        auto &p = h.promise();
+        p.wait = Wait::TIMER;
+        p.timer = m_timers.emplace(deadline, h);
+    }
+
+    // coroutine is being destroyed, drop every reference to it
+    void forget(Handle h)
+    {
+        auto &p = h.promise();
+        switch (p.wait)
+        {
+        case Wait::READY:
+            m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), h), m_ready.end());
+            break;
+        case Wait::FD:
+            if (auto it = m_parked.find(p.op->fd()); it != m_parked.end())
+            {
+                Parked &parked = it->second;
+                (p.op->kind() == IoOp::Kind::READ ? parked.reader : parked.writer) = nullptr;
+                if (!parked.reader && !parked.writer)
+                    m_parked.erase(it);
+            }
+            break;
+        case Wait::TIMER:
+            m_timers.erase(p.timer);
+            break;
+        case Wait::NONE:
+            break;
+        }
+
+        p.wait = Wait::NONE;
+    }
+
+private:
+    struct Parked
+    {
+        Handle reader;
+        Handle writer;
+    };
+
+    size_t m_budget;
+    std::deque<Handle> m_ready;
+    std::unordered_map<int, Parked> m_parked;
+    std::multimap<Clock::time_point, Handle> m_timers;
+    std::function<void(int)> m_onFinished;
+
+    void post(Handle h)
+    {
+        h.promise().wait = Wait::READY;
+        m_ready.push_back(h);
+    }
+
+    // returns true when op is done and the coroutine may go on
+    bool complete(Handle h, IoOp &op)
+    {
+        auto &p = h.promise();
+        switch (op.attempt(p.budget))
+        {
+        case IoOp::Status::DONE:
+            return true;
+        case IoOp::Status::YIELD:
+            post(h);
+            return false;
+        case IoOp::Status::WOULD_BLOCK:
+            park(h, op);
+            return false;
+        }
+
+        return false;
+    }
+
+    void park(Handle h, IoOp &op)
+    {
+        Parked &parked = m_parked[op.fd()];
+        (op.kind() == IoOp::Kind::READ ? parked.reader : parked.writer) = h;
+        h.promise().wait = Wait::FD;
+    }
+};
+
+void Task::release()
+{
+    if (!m_handle)
+        return;
+
+    if (m_handle.promise().scheduler)
+        m_handle.promise().scheduler->forget(m_handle);
+
+    m_handle.destroy();
+    m_handle = nullptr;
+}
+
+class IoAwaiter
+{
+public:
+    IoAwaiter(const int fd, const IoOp::Kind kind, char *buffer, const size_t size, const bool wait = true,
+              uint32_t *zeroCopySends = nullptr, std::vector<char> *overflow = nullptr)
+        : m_op(fd, kind, buffer, size, wait, zeroCopySends, overflow) {}
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    // tries right away and suspends only when the socket is not ready or the turn is over
+    bool await_suspend(Task::Handle h)
+    {
+        return h.promise().scheduler->suspend(h, m_op);
+    }
+
+    ssize_t await_resume() const noexcept
+    {
+        return m_op.result();
+    }
+
+private:
+    IoOp m_op;
+};
+
+class SleepAwaiter
+{
+public:
+    explicit SleepAwaiter(const Scheduler::Clock::duration duration) : m_duration(duration) {}
+
+    bool await_ready() const noexcept
+    {
+        return m_duration <= Scheduler::Clock::duration::zero();
+    }
+
+    void await_suspend(Task::Handle h)
+    {
+        h.promise().scheduler->sleep(h, Scheduler::Clock::now() + m_duration);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Scheduler::Clock::duration m_duration;
+};
+
+// non-owning view of a nonblocking socket registered in epoll with EPOLLET,
+// events for it have to be passed to Scheduler::notify
+class AsyncSocket
+{
+public:
+    explicit AsyncSocket(const int fd) : m_fd(fd) {}
+
+    // bytes read, 0 on end of stream, -1 on error
+    IoAwaiter read(std::span<char> buffer) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::READ, buffer.data(), buffer.size());
+    }
+
+    // like read but -1 with errno EAGAIN when nothing is available
+    IoAwaiter tryRead(std::span<char> buffer) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::READ, buffer.data(), buffer.size(), false);
+    }
+
+    // reads that continue into overflow once buffer is full, bytes in overflow have
+    // to be taken out before another read uses it
+    IoAwaiter read(std::span<char> buffer, std::vector<char> &overflow) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::READ, buffer.data(), buffer.size(), true, nullptr, &overflow);
+    }
+
+    IoAwaiter tryRead(std::span<char> buffer, std::vector<char> &overflow) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::READ, buffer.data(), buffer.size(), false, nullptr, &overflow);
+    }
+
+    // completes when everything is written, -1 on error
+    IoAwaiter write(std::span<const char> buffer) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::WRITE, const_cast<char *>(buffer.data()), buffer.size());
+    }
+
+    // write with MSG_ZEROCOPY, sends counts calls the kernel reports completion for
+    // and buffer may not change until then, see ZeroCopy
+    IoAwaiter writeZeroCopy(std::span<const char> buffer, uint32_t &sends) const
+    {
+        return IoAwaiter(m_fd, IoOp::Kind::WRITE, const_cast<char *>(buffer.data()), buffer.size(), true, &sends);
+    }
+
+private:
+    int m_fd;
+};
+
+inline SleepAwaiter sleep_for(const Scheduler::Clock::duration duration)
+{
+    return SleepAwaiter(duration);
+}
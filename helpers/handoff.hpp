@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "helpers.hpp"
+
+// Passing file descriptors between processes over unix socket (SCM_RIGHTS).
+// SOCK_SEQPACKET keeps every record together with its descriptor.
+
+struct HandoffRecord
+{
+    enum class Type : uint8_t
+    {
+        LISTENER,
+        // next instance polls the listener, the running one may stop accepting
+        READY,
+        CLIENT,
+        DONE,
+    };
+
+    // CLIENT: what the next instance continues the connection from
+    struct Client
+    {
+        // capture id, the connection stays one across instances
+        uint64_t connection;
+        // integrity check of the string and trailer the client is in the middle of
+        uint32_t crc;
+        uint32_t expected;
+        uint32_t trailer;
+        uint32_t trailerSize;
+    };
+
+    Type type;
+    Client client;
+};
+
+class UnixSocket : public Socket
+{
+public:
+    UnixSocket() : Socket(AF_UNIX, SOCK_SEQPACKET, 0) {}
+    explicit UnixSocket(const int fd) : Socket(fd) {}
+
+    bool listen(const char *path, const int backlog)
+    {
+        struct sockaddr_un a = address(path);
+        unlink(path);
+        return -1 != bind(*this, reinterpret_cast<struct sockaddr *>(&a), sizeof(a)) &&
+               -1 != ::listen(*this, backlog);
+    }
+
+    bool connect(const char *path)
+    {
+        struct sockaddr_un a = address(path);
+        return -1 != ::connect(*this, reinterpret_cast<struct sockaddr *>(&a), sizeof(a));
+    }
+
+    // fd is not sent when negative
+    bool send(const HandoffRecord &record, const int fd)
+    {
+        HandoffRecord r = record;
+        struct iovec iov{&r, sizeof(r)};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+        if (fd >= 0)
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(c), &fd, sizeof(fd));
+        }
+
+        return sizeof(r) == sendmsg(*this, &msg, MSG_NOSIGNAL);
+    }
+
+    // returns number of bytes received as recvmsg does, fd is -1 if none was attached
+    ssize_t receive(HandoffRecord &record, int &fd)
+    {
+        struct iovec iov{&record, sizeof(record)};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        fd = -1;
+        const ssize_t num = recvmsg(*this, &msg, MSG_CMSG_CLOEXEC);
+        if (num <= 0)
+            return num;
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+                memcpy(&fd, CMSG_DATA(c), sizeof(fd));
+        }
+
+        return num;
+    }
+
+private:
+    static struct sockaddr_un address(const char *path)
+    {
+        struct sockaddr_un a{};
+        a.sun_family = AF_UNIX;
+        strncpy(a.sun_path, path, sizeof(a.sun_path) - 1);
+        return a;
+    }
+};
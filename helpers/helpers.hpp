@@ -13,6 +13,38 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+// Leaves elements default-initialized, so resizing a buffer that is about to be
+// overwritten by a read does not zero-fill it first.
+template <typename T>
+class UninitializedAllocator : public std::allocator<T>
+{
+public:
+    template <typename U>
+    struct rebind
+    {
+        using other = UninitializedAllocator<U>;
+    };
+
+    UninitializedAllocator() = default;
+
+    template <typename U>
+    UninitializedAllocator(const UninitializedAllocator<U> &) noexcept {}
+
+    template <typename U>
+    void construct(U *p) noexcept
+    {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+using ByteBuffer = std::vector<char, UninitializedAllocator<char>>;
+
 class FD
 {
 public:
@@ -54,6 +86,9 @@ class Socket : public FD
 public:
     Socket(const int domain, const int type, const int protocol)
         : FD(socket(domain, type, protocol)) {}
+
+    // takes ownership of already created socket
+    explicit Socket(const int fd) : FD(fd) {}
 };
 
 class Epoll : public FD
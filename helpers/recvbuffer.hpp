@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <utility>
+
+#include "helpers.hpp"
+
+// Receive buffer of a connection: few bytes inline for pings, growing on the
+// heap to the size of recent bursts for bulk transfers. Reads go to its free
+// space first and spill into an overflow buffer shared by all connections,
+// which has to be committed before anything else reads into it. Heap storage
+// is allocated only when a read spills, never zero-filled.
+class RecvBuffer
+{
+public:
+    static constexpr size_t INLINE_SIZE = 128;
+
+    RecvBuffer() = default;
+
+    RecvBuffer(const RecvBuffer &b) = delete;
+    const RecvBuffer &operator=(const RecvBuffer &b) = delete;
+
+    char *data()
+    {
+        return onHeap() ? m_heap.data() : m_inline;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool onHeap() const
+    {
+        return !m_heap.empty();
+    }
+
+    // bytes held by the connection besides the inline part
+    size_t heapBytes() const
+    {
+        return m_heap.capacity();
+    }
+
+    // where the next read goes before spilling into the overflow
+    std::span<char> space()
+    {
+        return {data() + m_size, capacity() - m_size};
+    }
+
+    // num bytes were read into space and then overflow
+    void commit(const size_t num, const char *overflow)
+    {
+        const size_t direct = std::min(num, capacity() - m_size);
+        m_size += direct;
+        if (num == direct)
+            return;
+
+        // room for a burst as large as recent ones, so that the rest of it is read directly
+        grow(std::max(m_size + num - direct, m_average));
+        memcpy(data() + m_size, overflow, num - direct);
+        m_size += num - direct;
+    }
+
+    // everything is echoed: storage much larger than recent bursts, up to max, is
+    // given back, commit allocates again when a burst needs it
+    void consume(const size_t max)
+    {
+        // a taken burst is already averaged in
+        if (m_size > 0)
+            average(m_size);
+        m_size = 0;
+
+        const size_t target = std::min(std::bit_ceil(std::max(m_average, size_t{1})), max);
+        if (onHeap() && (target <= INLINE_SIZE || heapBytes() > 2 * target))
+            m_heap = ByteBuffer();
+    }
+
+    // connection goes idle, keep the inline part only
+    void release()
+    {
+        if (onHeap() && m_size <= INLINE_SIZE)
+        {
+            memcpy(m_inline, m_heap.data(), m_size);
+            m_heap = ByteBuffer();
+        }
+    }
+
+    // hands the data over e.g. to be pinned for zero-copy, buffer is empty then
+    ByteBuffer take()
+    {
+        average(m_size);
+        ByteBuffer result = onHeap() ? std::exchange(m_heap, {}) : ByteBuffer(m_inline, m_inline + m_size);
+        result.resize(m_size);
+        m_size = 0;
+        return result;
+    }
+
+    // reuses released storage
+    void adopt(ByteBuffer &&storage)
+    {
+        if (0 == m_size && storage.capacity() > capacity())
+        {
+            storage.resize(storage.capacity());
+            m_heap = std::move(storage);
+        }
+    }
+
+private:
+    char m_inline[INLINE_SIZE];
+    // whole vector is storage, m_size of it is used
+    ByteBuffer m_heap;
+    size_t m_size = 0;
+    size_t m_average = 0;
+
+    size_t capacity() const
+    {
+        return onHeap() ? m_heap.size() : INLINE_SIZE;
+    }
+
+    // moving average over the last several bursts
+    void average(const size_t burst)
+    {
+        m_average = m_average - m_average / 8 + burst / 8;
+    }
+
+    void grow(const size_t size)
+    {
+        if (size <= capacity())
+            return;
+
+        ByteBuffer heap(std::bit_ceil(size));
+        memcpy(heap.data(), data(), m_size);
+        m_heap = std::move(heap);
+    }
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "helpers.hpp"
+
+// MSG_ZEROCOPY sends reference pages of the buffer instead of copying them to
+// the kernel. The kernel numbers every such send call on the socket and reports
+// ranges of numbers it is done with on the socket error queue (EPOLLERR), a
+// buffer may not be touched or freed until all its sends are reported.
+
+class ZeroCopy
+{
+public:
+    struct Pinned
+    {
+        ByteBuffer data;
+        // number of the first send of this buffer
+        uint32_t first = 0;
+        // send calls that went through with MSG_ZEROCOPY
+        uint32_t sends = 0;
+        uint32_t completed = 0;
+        // no more sends from this buffer
+        bool sealed = false;
+    };
+
+    bool enable(const int fd)
+    {
+        const int one = 1;
+        m_enabled = (0 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)));
+        return m_enabled;
+    }
+
+    // kernel falls back to copying e.g. over loopback, zero-copy only costs more then
+    bool enabled() const
+    {
+        return m_enabled && 0 == m_copied;
+    }
+
+    // buffers not released by the kernel yet
+    size_t pinned() const
+    {
+        return m_pinned.size();
+    }
+
+    // sends completed by the kernel and the ones it had to copy anyway
+    uint64_t completed() const
+    {
+        return m_completed;
+    }
+
+    uint64_t copied() const
+    {
+        return m_copied;
+    }
+
+    // buffers waiting for the kernel or kept for reuse
+    size_t heapBytes() const
+    {
+        size_t bytes = 0;
+        for (const Pinned &p : m_pinned)
+            bytes += p.data.capacity();
+        for (const auto &b : m_free)
+            bytes += b.capacity();
+        return bytes;
+    }
+
+    // buffer is going to be sent, the reference stays valid until it is sealed
+    Pinned &pin(ByteBuffer &&data)
+    {
+        m_pinned.push_back({std::move(data), m_next});
+        return m_pinned.back();
+    }
+
+    void seal(Pinned &p)
+    {
+        p.sealed = true;
+        m_next = p.first + p.sends;
+        release();
+    }
+
+    // empty buffer, recycled from released ones when possible
+    ByteBuffer buffer()
+    {
+        if (m_free.empty())
+            return {};
+
+        ByteBuffer b = std::move(m_free.back());
+        m_free.pop_back();
+        b.clear();
+        return b;
+    }
+
+    // connection goes idle, buffers kept for reuse are not worth holding
+    void shrink()
+    {
+        m_free.clear();
+    }
+
+    // reads all completions from the error queue, returns false on error
+    bool reap(const int fd)
+    {
+        while (1)
+        {
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+            struct msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT))
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+
+            for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+            {
+                if (!(c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) &&
+                    !(c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))
+                    continue;
+
+                const auto *e = reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(c));
+                if (e->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+
+                // range of send numbers, inclusive
+                const uint32_t count = e->ee_data - e->ee_info + 1;
+                m_completed += count;
+                if (e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    m_copied += count;
+
+                complete(e->ee_info, e->ee_data);
+            }
+        }
+    }
+
+private:
+    // released buffers kept for reuse
+    static constexpr size_t FREE_BUFFERS = 4;
+
+    bool m_enabled = false;
+    // number of the next send, wraps after 2^32 sends like the kernel counter
+    uint32_t m_next = 0;
+    uint64_t m_completed = 0;
+    uint64_t m_copied = 0;
+    std::deque<Pinned> m_pinned;
+    std::vector<ByteBuffer> m_free;
+
+    void complete(const uint32_t lo, const uint32_t hi)
+    {
+        for (Pinned &p : m_pinned)
+        {
+            // overlap of [lo, hi] and [first, first + sends), relative to first so that wrapping works
+            const uint32_t begin = lo - p.first;
+            const uint32_t end = hi - p.first + 1;
+            if (begin < p.sends)
+                p.completed += std::min(end, p.sends) - begin;
+            else if (end - 1 < begin)
+                p.completed += std::min(end, p.sends);
+        }
+
+        release();
+    }
+
+    // TCP completes sends in order, release from the front only so references stay valid
+    void release()
+    {
+        while (!m_pinned.empty() && m_pinned.front().sealed && m_pinned.front().completed >= m_pinned.front().sends)
+        {
+            if (m_free.size() < FREE_BUFFERS)
+                m_free.push_back(std::move(m_pinned.front().data));
+            m_pinned.pop_front();
+        }
+    }
+};
@@ -142,6 +142,11 @@ bool Logger::log(const Logger::Level level, const char *msg)
     return true;
 }
 
+void Logger::setLevel(const Logger::Level level)
+{
+    m_level = level;
+}
+
 unique_ptr<Logger> LoggerFactory::getFileLogger(const char *filename, Logger::Level level /* = Logger::Level::INFO*/)
 {
     return make_unique<FileLogger>(filename, level);
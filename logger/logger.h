@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 class Logger
@@ -16,9 +17,10 @@ public:
     virtual ~Logger() = default;
 
     bool log(const Logger::Level level, const char *msg);
+    void setLevel(const Logger::Level level);
 
 private:
-    Level m_level;
+    std::atomic<Level> m_level;
 
     virtual void logMsg(const Logger::Level level, const char *msg) = 0;
 };
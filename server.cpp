@@ -1,15 +1,34 @@
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <climits>
 #include <memory>
 #include <string>
 #include <sstream>
-#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <signal.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 
+#include <capture/capture.h>
+#include <config/config.h>
+#include <crc32c/crc32c.h>
+#include <helpers/coroutine.hpp>
+#include <helpers/handoff.hpp>
 #include <helpers/helpers.hpp>
+#include <helpers/recvbuffer.hpp>
+#include <helpers/zerocopy.hpp>
 #include <logger/logger.h>
 
 #include "server_config.h"
@@ -23,15 +42,32 @@ using namespace std;
 #define _count_of(a) (sizeof(a) / sizeof(*a))
 
 #define SERVER_EVENTS (EPOLLIN | EPOLLET)
-// need EPOLLONESHOT to avoid being triggered by multiple writes while processing echo in separate thread
-#define CLIENT_EVENTS (EPOLLIN | EPOLLET | EPOLLHUP | EPOLLRDHUP | EPOLLONESHOT)
+#define HANDOFF_EVENTS (EPOLLIN | EPOLLET)
+#define SIGNAL_EVENTS (EPOLLIN | EPOLLET)
+// all connections are served from the event loop, readiness is remembered per connection
+#define CLIENT_EVENTS (EPOLLIN | EPOLLOUT | EPOLLET | EPOLLHUP | EPOLLRDHUP)
 
 namespace
 {
+    // loaded in main before anything else is used
+    ServerConfig &getConfig()
+    {
+        static ServerConfig config;
+        return config;
+    }
+
+    // command line the config was loaded from, loaded again on SIGHUP
+    vector<string> &getConfigArgs()
+    {
+        static vector<string> args;
+        return args;
+    }
+
     Logger &getLogger()
     {
-        static std::unique_ptr<Logger> l{LoggerFactory::getFileLogger(LOG_FILE, LOG_LEVEL)};
-        //static std::unique_ptr<Logger> l{LoggerFactory::getConsoleLogger(LOG_LEVEL)};
+        static std::unique_ptr<Logger> l{getConfig().logFile == "-"
+                                             ? LoggerFactory::getConsoleLogger(getConfig().logLevel)
+                                             : LoggerFactory::getFileLogger(getConfig().logFile.c_str(), getConfig().logLevel)};
         return *l;
     }
 
@@ -42,7 +78,7 @@ namespace
         struct sockaddr_in a{};
         a.sin_family = AF_INET;
         a.sin_addr.s_addr = INADDR_ANY;
-        a.sin_port = htons(PORT);
+        a.sin_port = htons(getConfig().port);
 
         const int fd = *s;
         if (-1 == bind(fd, reinterpret_cast<struct sockaddr *>(&a), sizeof(a)))
@@ -51,7 +87,7 @@ namespace
             return nullptr;
         }
 
-        if (-1 == listen(fd, MAX_CONN))
+        if (-1 == listen(fd, getConfig().backlog))
         {
             LOG_ERROR("Failed to listen");
             return nullptr;
@@ -60,18 +96,264 @@ namespace
         return s;
     }
 
+    // either created by createSocket or received from the previous instance on hot restart
     shared_ptr<Socket> &getServerSocket()
     {
-        static shared_ptr<Socket> s = createSocket();
+        static shared_ptr<Socket> s;
         return s;
     }
 
+    // listens for the next instance asking to take over
+    shared_ptr<UnixSocket> &getHandoffSocket()
+    {
+        static shared_ptr<UnixSocket> s;
+        return s;
+    }
+
+    // connection to the instance taking over, or to the one being replaced
+    shared_ptr<UnixSocket> &getHandoffChannel()
+    {
+        static shared_ptr<UnixSocket> s;
+        return s;
+    }
+
+    // running instance: listener is sent, waiting for the next instance to report READY
+    bool &isHandingOff()
+    {
+        static bool handingOff = false;
+        return handingOff;
+    }
+
+    bool &isDraining()
+    {
+        static bool draining = false;
+        return draining;
+    }
+
+    // connections still echoing are closed once it passes
+    Scheduler::Clock::time_point &getDrainDeadline()
+    {
+        static Scheduler::Clock::time_point deadline;
+        return deadline;
+    }
+
+    bool &isAcceptPostponed()
+    {
+        static bool postponed = false;
+        return postponed;
+    }
+
     Epoll &getEpoll()
     {
         static Epoll ep;
         return ep;
     }
 
+    bool pinToCpu(const int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (0 != pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        {
+            LOG_ERROR("Failed to set CPU affinity");
+            return false;
+        }
+
+        return true;
+    }
+
+    // connection buffers are allocated and touched by the event loop thread only,
+    // prefer the node it runs on even when the local node is short of memory
+    void preferLocalNode()
+    {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (-1 == syscall(SYS_getcpu, &cpu, &node, nullptr))
+        {
+            LOG_ERROR("Failed to get NUMA node");
+            return;
+        }
+
+        unsigned long mask[4] = {0};
+        constexpr unsigned long bits = 8 * sizeof(*mask);
+        if (node >= bits * _count_of(mask))
+            return;
+
+        mask[node / bits] = 1UL << (node % bits);
+        if (-1 == syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, bits * _count_of(mask)))
+            LOG_ERROR("Failed to set NUMA memory policy");
+    }
+
+    void tuneClientSocket(const int fd)
+    {
+        if (getConfig().busyPoll)
+        {
+            const int usec = getConfig().busyPollUsec;
+            if (-1 == setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)))
+                LOG_DEBUG("Failed to set SO_BUSY_POLL");
+        }
+    }
+
+    // Splits client stream into human-readable strings terminated by 0 and logs
+    // each of them once complete. In integrity mode every string is followed by
+    // CRC32C of it (terminating 0 included), little-endian.
+    class MessageParser
+    {
+    public:
+        // returns false on checksum mismatch
+        bool feed(const char *data, const size_t size)
+        {
+            const char *p = data;
+            const char *const end = p + size;
+            while (p != end)
+            {
+                if (m_trailerSize < TRAILER_SIZE)
+                {
+                    for (; p != end && m_trailerSize < TRAILER_SIZE; ++p, ++m_trailerSize)
+                        m_trailer |= static_cast<uint32_t>(static_cast<uint8_t>(*p)) << (8 * m_trailerSize);
+
+                    if (m_trailerSize == TRAILER_SIZE && m_trailer != m_expected)
+                        return false;
+
+                    continue;
+                }
+
+                const char *zero = static_cast<const char *>(memchr(p, 0, end - p));
+                const char *next = zero ? zero + 1 : end;
+                if (INTEGRITY_CHECK)
+                    m_crc = Crc32c::compute(p, next - p, m_crc);
+
+                m_msg.append(p, zero ? zero : end);
+                if (zero)
+                {
+                    LOG_INFO(m_msg.c_str());
+                    m_msg.clear();
+                    // a long message should not stay allocated for the life of the connection
+                    if (m_msg.capacity() > RecvBuffer::INLINE_SIZE)
+                        m_msg.shrink_to_fit();
+                    if (INTEGRITY_CHECK)
+                    {
+                        m_trailer = 0;
+                        m_trailerSize = 0;
+                        m_expected = m_crc;
+                        m_crc = 0;
+                    }
+                }
+
+                p = next;
+            }
+
+            // do not hold unterminated data forever
+            if (m_msg.size() >= getConfig().turnBudget)
+            {
+                LOG_INFO(m_msg.c_str());
+                m_msg.clear();
+            }
+
+            return true;
+        }
+
+        // beyond what the string keeps inline
+        size_t heapBytes() const
+        {
+            return m_msg.capacity() > string().capacity() ? m_msg.capacity() + 1 : 0;
+        }
+
+        // the next instance continues in the middle of a string or trailer,
+        // text received so far is logged here
+        void handOff(HandoffRecord::Client &state)
+        {
+            if (!m_msg.empty())
+            {
+                LOG_INFO(m_msg.c_str());
+                m_msg.clear();
+            }
+
+            state.crc = m_crc;
+            state.expected = m_expected;
+            state.trailer = m_trailer;
+            state.trailerSize = m_trailerSize;
+        }
+
+        void takeOver(const HandoffRecord::Client &state)
+        {
+            m_crc = state.crc;
+            m_expected = state.expected;
+            m_trailer = state.trailer;
+            m_trailerSize = min<size_t>(state.trailerSize, TRAILER_SIZE);
+        }
+
+    private:
+        static constexpr size_t TRAILER_SIZE = sizeof(uint32_t);
+
+        string m_msg;
+        // of the string being received
+        uint32_t m_crc = 0;
+        // of the last complete string, to compare with its trailer
+        uint32_t m_expected = 0;
+        uint32_t m_trailer = 0;
+        size_t m_trailerSize = TRAILER_SIZE;
+    };
+
+    struct Connection
+    {
+        // unique across instances appending to the same capture
+        uint64_t id;
+        Task task;
+        RecvBuffer recv;
+        MessageParser parser;
+        // echoes the kernel may still send from, only with zero-copy enabled
+        unique_ptr<ZeroCopy> zeroCopy;
+
+        bool pinned() const
+        {
+            return zeroCopy && zeroCopy->pinned();
+        }
+
+        // allocated by the connection besides itself and its coroutine frame
+        size_t heapBytes() const
+        {
+            return recv.heapBytes() + parser.heapBytes() + (zeroCopy ? sizeof(ZeroCopy) + zeroCopy->heapBytes() : 0);
+        }
+    };
+
+    unordered_map<int, Connection> &getConnections()
+    {
+        static unordered_map<int, Connection> connections;
+        return connections;
+    }
+
+    // nullptr unless traffic capture is enabled
+    unique_ptr<CaptureWriter> &getCapture()
+    {
+        static unique_ptr<CaptureWriter> c{getConfig().captureFile.empty()
+                                               ? nullptr
+                                               : make_unique<CaptureWriter>(getConfig().captureFile.c_str(), getConfig().capturePayload)};
+        return c;
+    }
+
+    uint64_t nextConnectionId()
+    {
+        static uint32_t counter = 0;
+        return (static_cast<uint64_t>(getpid()) << 32) | ++counter;
+    }
+
+    // reads of all connections spill into it, sized by buffer-size in main and on reload
+    vector<char> &getOverflow()
+    {
+        static vector<char> overflow;
+        return overflow;
+    }
+
+    Scheduler &getScheduler()
+    {
+        static Scheduler s{getConfig().turnBudget};
+        return s;
+    }
+
+    void spawnConnection(const int fd, const HandoffRecord::Client *handedOff);
+
     bool handleServerEvent(const int32_t events)
     {
         LOG_DEBUG("Handling server event");
@@ -94,103 +376,535 @@ namespace
                     break;
                 }
 
-                // continue to process other connections
+                if (errno == EMFILE || errno == ENFILE)
+                {
+                    // pending connections stay in the backlog until some connection is closed
+                    LOG_ERROR("Out of file descriptors, postponing accept");
+                    isAcceptPostponed() = true;
+                    break;
+                }
+
                 LOG_ERROR("Failed to accept connection");
-                continue;
+                if (errno == ECONNABORTED || errno == EINTR || errno == EPROTO)
+                {
+                    // continue to process other connections
+                    continue;
+                }
+
+                break;
             }
 
             std::shared_ptr<FD> client{std::make_shared<FD>(result)};
+            tuneClientSocket(result);
             if (getEpoll().addNonblocking(client, CLIENT_EVENTS))
+            {
+                spawnConnection(result, nullptr);
                 LOG_DEBUG("Client connection opened");
+            }
         }
 
         return true;
     }
 
-    void handleEcho(FD &&socket)
+    void closeConnection(const int fd)
     {
-        // data is supposed to be human-readable string
-        std::vector<char> msg;
-        char buffer[SERVER_BUFFEER_SIZE] = {0};
-        ssize_t num;
-        while (0 < (num = read(socket, static_cast<void *>(buffer), sizeof(buffer))))
+        auto it = getConnections().find(fd);
+        if (it != getConnections().end())
         {
-            msg.insert(msg.end(), buffer, buffer + num);
+            // socket stays open until the kernel reports it is done with zero-copy buffers
+            if (it->second.pinned())
+                return;
+
+            if (getCapture())
+                getCapture()->record(CaptureRecord::Type::CLOSE, it->second.id);
         }
 
-        if (-1 == num && errno != EAGAIN && errno != EWOULDBLOCK)
+        getConnections().erase(fd);
+        getEpoll().remove(fd);
+
+        // edge-triggered server socket will not report connections that already wait
+        if (isAcceptPostponed() && !isDraining())
         {
-            LOG_ERROR("Failed to read from socket");
-            return;
+            isAcceptPostponed() = false;
+            handleServerEvent(EPOLLIN);
         }
+    }
 
-        LOG_DEBUG("Data read");
-        if (-1 == write(socket, static_cast<const void *>(msg.data()), msg.size()))
+    Task echo(const int fd, Connection &conn)
+    {
+        const AsyncSocket socket(fd);
+        RecvBuffer &recv = conn.recv;
+        MessageParser &parser = conn.parser;
+        while (1)
         {
-            LOG_ERROR("Failed to write to socket");
-            return;
+            size_t requested = recv.space().size() + getOverflow().size();
+            ssize_t num = co_await socket.tryRead(recv.space(), getOverflow());
+            if (-1 == num && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                // idle connection keeps just the inline part of its buffer while it waits
+                recv.release();
+                if (conn.zeroCopy)
+                    conn.zeroCopy->shrink();
+                requested = recv.space().size() + getOverflow().size();
+                num = co_await socket.read(recv.space(), getOverflow());
+            }
+
+            if (0 == num)
+            {
+                LOG_DEBUG("Client connection closed");
+                co_return;
+            }
+
+            if (-1 == num)
+            {
+                LOG_ERROR("Failed to read from socket");
+                co_return;
+            }
+
+            // burst is captured as arrived with its first read, not once all of it is read
+            const uint64_t arrivedNs = getCapture() ? CaptureWriter::now() : 0;
+
+            // echo everything the client has sent so far in one write,
+            // leave half of the turn for writing it back
+            recv.commit(num, getOverflow().data());
+            while (static_cast<size_t>(num) == requested && recv.size() < getConfig().turnBudget / 2)
+            {
+                requested = recv.space().size() + getOverflow().size();
+                num = co_await socket.tryRead(recv.space(), getOverflow());
+                if (num > 0)
+                    recv.commit(num, getOverflow().data());
+            }
+
+            if (-1 == num && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_ERROR("Failed to read from socket");
+                co_return;
+            }
+
+            LOG_DEBUG("Data read");
+            if (getCapture())
+                getCapture()->record(CaptureRecord::Type::DATA, conn.id, recv.size(), recv.data(), arrivedNs);
+
+            if (!parser.feed(recv.data(), recv.size()))
+            {
+                // corrupted data is not echoed back
+                LOG_ERROR("Checksum mismatch, closing connection");
+                co_return;
+            }
+
+            ssize_t written = -1;
+            if (conn.zeroCopy && conn.zeroCopy->enabled() && recv.size() >= getConfig().zeroCopyThreshold)
+            {
+                // buffer stays pinned until the kernel is done with it, next data goes to another one
+                ZeroCopy::Pinned &pinned = conn.zeroCopy->pin(recv.take());
+                written = co_await socket.writeZeroCopy(pinned.data, pinned.sends);
+                conn.zeroCopy->seal(pinned);
+                recv.adopt(conn.zeroCopy->buffer());
+            }
+            else
+            {
+                written = co_await socket.write({recv.data(), recv.size()});
+            }
+
+            if (-1 == written)
+            {
+                LOG_ERROR("Failed to write to socket");
+                co_return;
+            }
+
+            LOG_DEBUG("Data sent");
+            if (getCapture())
+                getCapture()->record(CaptureRecord::Type::ECHOED, conn.id, written);
+            recv.consume(getConfig().turnBudget / 2);
+
+            if (0 == num)
+            {
+                LOG_DEBUG("Client connection closed");
+                co_return;
+            }
         }
+    }
 
-        LOG_DEBUG("Data sent");
-        LOG_INFO(string(msg.begin(), msg.end()).c_str());
+    // handedOff is the state passed by the previous instance, nullptr for accepted connections
+    void spawnConnection(const int fd, const HandoffRecord::Client *handedOff)
+    {
+        const uint64_t id = handedOff ? handedOff->connection : nextConnectionId();
+        Connection &conn = getConnections()[fd];
+        conn.id = id;
+        if (handedOff)
+            conn.parser.takeOver(*handedOff);
+        if (getConfig().zeroCopy)
+        {
+            conn.zeroCopy = make_unique<ZeroCopy>();
+            if (!conn.zeroCopy->enable(fd))
+            {
+                LOG_DEBUG("Failed to set SO_ZEROCOPY");
+                conn.zeroCopy.reset();
+            }
+        }
+
+        conn.task = echo(fd, conn);
+        getScheduler().spawn(conn.task, fd);
+
+        if (getCapture() && !handedOff)
+            getCapture()->record(CaptureRecord::Type::OPEN, id);
     }
 
     void handleClientEvent(const int fd, const uint32_t events)
     {
         LOG_DEBUG("Handling client event");
 
-        bool isAlive = true;
-        uint32_t leftover = events;
+        auto it = getConnections().find(fd);
+        if (it != getConnections().end() && it->second.pinned())
+        {
+            // zero-copy completions are reported as EPOLLERR as well
+            if (!it->second.zeroCopy->reap(fd))
+                LOG_ERROR("Failed to read zero-copy completions");
+
+            // buffers released while the handler waits for data are not going to be reused soon
+            if (getScheduler().isWaitingToRead(fd))
+                it->second.zeroCopy->shrink();
 
-        if (events & (EPOLLRDHUP | EPOLLHUP))
+            // handler finished while the kernel was still sending
+            if (it->second.task.handle().done() && !it->second.pinned())
+            {
+                closeConnection(fd);
+                return;
+            }
+        }
+        else if (events & EPOLLERR)
         {
-            // connection closed
-            LOG_DEBUG("Client connection closed");
-            getEpoll().remove(fd);
-            isAlive = false;
+            LOG_ERROR("Error happened on client connection");
+        }
+
+        if (events & ~(EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            LOG_ERROR("Unexpected event");
+
+        // handler gets the error or end of stream from its next read/write and finishes
+        getScheduler().notify(fd, events);
+    }
 
-            leftover &= ~(EPOLLRDHUP | EPOLLHUP);
+
+    bool listenForHandoff()
+    {
+        shared_ptr<UnixSocket> s{make_shared<UnixSocket>()};
+        if (!s->listen(getConfig().handoffSocket.c_str(), 1))
+        {
+            LOG_ERROR("Failed to listen for hot restart");
+            return false;
         }
 
-        if (events & EPOLLERR)
+        if (!getEpoll().addNonblocking(s, HANDOFF_EVENTS))
+            return false;
+
+        getHandoffSocket() = s;
+        return true;
+    }
+
+    // hot restart: receive listening socket from the running instance instead of bind/listen
+    bool takeOver()
+    {
+        shared_ptr<UnixSocket> channel{make_shared<UnixSocket>()};
+        if (!channel->connect(getConfig().handoffSocket.c_str()))
         {
-            // error happened
-            LOG_ERROR("Error happened on client connection");
-            getEpoll().remove(fd);
-            isAlive = false;
+            LOG_ERROR("Failed to connect to running server");
+            return false;
+        }
 
-            leftover &= ~(EPOLLERR);
+        HandoffRecord record{};
+        int fd = -1;
+        if (sizeof(record) != channel->receive(record, fd) || record.type != HandoffRecord::Type::LISTENER || fd < 0)
+        {
+            LOG_ERROR("Failed to receive server socket");
+            if (fd >= 0)
+                close(fd);
+            return false;
         }
 
-        if (isAlive && (events & EPOLLIN))
+        // running instance keeps accepting until READY, closing the channel before it lets it carry on
+        getServerSocket() = make_shared<Socket>(fd);
+        if (!getEpoll().addNonblocking(getServerSocket(), SERVER_EVENTS) ||
+            !getEpoll().addNonblocking(channel, HANDOFF_EVENTS))
+            return false;
+
+        if (!channel->send({HandoffRecord::Type::READY}, -1))
         {
-            // incoming data
-            LOG_DEBUG("Incoming client data event");
+            LOG_ERROR("Failed to confirm taking over server socket");
+            return false;
+        }
 
-            // handle as separate thread to avoid block on read/write of big data
-            // number of threads created is limited by maximum number of connections
-            thread t([fd]
-                     {
-                         handleEcho(FD(dup(fd)));
-                         if (!getEpoll().rearm(fd, CLIENT_EVENTS))
-                         {
-                             LOG_ERROR("Failed to rearm client socket, removing it");
-                             getEpoll().remove(fd);
-                         }
-                     });
-            t.detach();
+        getHandoffChannel() = channel;
+        LOG_INFO("Took over server socket");
+        return true;
+    }
 
-            leftover &= ~(EPOLLIN);
+    // running instance: the next one is serving or has failed to start
+    void handleHandoffReady()
+    {
+        HandoffRecord record{};
+        int fd = -1;
+        const ssize_t num = getHandoffChannel()->receive(record, fd);
+        if (fd >= 0)
+            close(fd);
+
+        if (-1 == num && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        getEpoll().remove(*getHandoffChannel());
+        isHandingOff() = false;
+        if (sizeof(record) != num || record.type != HandoffRecord::Type::READY)
+        {
+            // keep serving, connections the next instance was woken up for may still wait
+            getHandoffChannel().reset();
+            LOG_ERROR("Next instance failed to take over, keeping server socket");
+            handleServerEvent(EPOLLIN);
+            return;
         }
-        else if (events & EPOLLIN)
+
+        // new connections are accepted by the next instance from now on,
+        // the path is already taken over by it
+        getEpoll().remove(*getServerSocket());
+        getEpoll().remove(*getHandoffSocket());
+        getHandoffSocket().reset();
+        isDraining() = true;
+        getDrainDeadline() = Scheduler::Clock::now() + chrono::milliseconds(getConfig().drainTimeoutMs);
+        LOG_INFO("Next instance is ready, draining connections");
+    }
+
+    // running instance: the next one asks to take over
+    void handleHandoffRequest()
+    {
+        const int result = accept(*getHandoffSocket(), nullptr, nullptr);
+        if (-1 == result)
         {
-            leftover &= ~(EPOLLIN);
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("Failed to accept hot restart connection");
+            return;
         }
 
-        if (leftover)
+        shared_ptr<UnixSocket> channel{make_shared<UnixSocket>(result)};
+        if (getHandoffChannel())
         {
-            LOG_ERROR("Unexpected event");
+            LOG_ERROR("Hot restart is already in progress");
+            return;
+        }
+
+        if (!channel->send({HandoffRecord::Type::LISTENER}, *getServerSocket()) ||
+            !getEpoll().addNonblocking(channel, HANDOFF_EVENTS))
+        {
+            LOG_ERROR("Failed to send server socket");
+            return;
+        }
+
+        // both instances accept until the next one reports READY
+        getHandoffChannel() = channel;
+        isHandingOff() = true;
+        LOG_INFO("Handed off server socket, waiting for next instance");
+        handleHandoffReady();
+    }
+
+    // next instance: connections passed by the one being replaced
+    void handleHandoffRecords()
+    {
+        while (1)
+        {
+            HandoffRecord record{};
+            int fd = -1;
+            const ssize_t num = getHandoffChannel()->receive(record, fd);
+            if (-1 == num && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+
+            if (sizeof(record) == num && record.type == HandoffRecord::Type::CLIENT && fd >= 0)
+            {
+                std::shared_ptr<FD> client{std::make_shared<FD>(fd)};
+                tuneClientSocket(fd);
+                if (getEpoll().addNonblocking(client, CLIENT_EVENTS))
+                {
+                    spawnConnection(fd, &record.client);
+                    LOG_DEBUG("Client connection taken over");
+                }
+                continue;
+            }
+
+            if (fd >= 0)
+                close(fd);
+
+            if (-1 == num || (sizeof(record) == num && record.type != HandoffRecord::Type::DONE))
+                LOG_ERROR("Failed to receive client connection");
+
+            // previous instance is done or gone
+            getEpoll().remove(*getHandoffChannel());
+            getHandoffChannel().reset();
+            LOG_INFO("Hot restart finished");
+            return;
+        }
+    }
+
+    // idle connection continues in the next instance with its state, the capture sees no close
+    void handOffConnection(const int fd)
+    {
+        Connection &conn = getConnections().at(fd);
+        if (!getConfig().handoffClients)
+        {
+            closeConnection(fd);
+            return;
         }
+
+        HandoffRecord record{HandoffRecord::Type::CLIENT, {conn.id}};
+        conn.parser.handOff(record.client);
+        if (!getHandoffChannel()->send(record, fd))
+        {
+            LOG_ERROR("Failed to hand off client connection");
+            closeConnection(fd);
+            return;
+        }
+
+        getConnections().erase(fd);
+        getEpoll().remove(fd);
+    }
+
+    // running instance after handoff: pass connections with no echo in flight, close
+    // the rest after drain timeout, returns true once all connections are gone
+    bool drainConnections()
+    {
+        const bool late = Scheduler::Clock::now() >= getDrainDeadline();
+        vector<int> idle;
+        vector<int> busy;
+        for (const auto &conn : getConnections())
+        {
+            // echo handler waiting for data has written everything it read,
+            // zero-copy buffers have to stay until the kernel has sent them
+            if (getScheduler().isWaitingToRead(conn.first) && !conn.second.pinned())
+                idle.push_back(conn.first);
+            else if (late)
+                busy.push_back(conn.first);
+        }
+
+        for (const int fd : idle)
+            handOffConnection(fd);
+
+        for (const int fd : busy)
+        {
+            // kernel keeps its own references to pages of zero-copy sends
+            getConnections().at(fd).zeroCopy.reset();
+            closeConnection(fd);
+        }
+
+        if (!busy.empty())
+            LOG_ERROR(("Drain timeout, closed " + to_string(busy.size()) + " connections").c_str());
+
+        if (!getConnections().empty())
+            return false;
+
+        if (!getHandoffChannel()->send({HandoffRecord::Type::DONE}, -1))
+            LOG_ERROR("Failed to finish hot restart");
+
+        return true;
+    }
+
+    // SIGHUP and SIGUSR1 are read from the event loop instead of interrupting it
+    shared_ptr<FD> &getSignals()
+    {
+        static shared_ptr<FD> s;
+        return s;
+    }
+
+    bool listenForSignals()
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGHUP);
+        sigaddset(&mask, SIGUSR1);
+        if (-1 == sigprocmask(SIG_BLOCK, &mask, nullptr))
+            return false;
+
+        shared_ptr<FD> s{make_shared<FD>(signalfd(-1, &mask, SFD_CLOEXEC))};
+        if (!getEpoll().addNonblocking(s, SIGNAL_EVENTS))
+            return false;
+
+        getSignals() = s;
+        return true;
+    }
+
+    // applies reloadable settings, the rest waits for restart
+    void reloadConfig()
+    {
+        ServerConfig next;
+        try
+        {
+            next = ServerConfig::load(getConfigArgs());
+        }
+        catch (const exception &e)
+        {
+            LOG_ERROR((string("Failed to reload config, keeping current one: ") + e.what()).c_str());
+            return;
+        }
+
+        const vector<string> restartRequired = getConfig().restartRequired(next);
+        getConfig().reload(next);
+        getLogger().setLevel(getConfig().logLevel);
+        getScheduler().setBudget(getConfig().turnBudget);
+        // parked reads pick up the new overflow when they retry
+        if (getOverflow().size() != getConfig().bufferSize)
+            getOverflow() = vector<char>(getConfig().bufferSize);
+
+        for (const auto &name : restartRequired)
+            LOG_INFO(("Changed " + name + " takes effect after restart").c_str());
+        LOG_INFO("Config reloaded");
+    }
+
+    // memory of idle connections and syscalls spent per MB echoed so far
+    void logMetrics()
+    {
+        size_t idle = 0;
+        size_t idleHeapBytes = 0;
+        for (const auto &[fd, conn] : getConnections())
+        {
+            if (getScheduler().isWaitingToRead(fd))
+            {
+                ++idle;
+                idleHeapBytes += conn.heapBytes();
+            }
+        }
+
+        // user space only, kernel socket buffers are not counted: connection with its hash
+        // node and bucket, parked handler, FD shared with epoll with its control block
+        constexpr size_t connectionBytes = sizeof(unordered_map<int, Connection>::value_type) + 2 * sizeof(void *) +
+                                           Scheduler::parkedBytes() + sizeof(shared_ptr<FD>) + sizeof(FD) +
+                                           2 * sizeof(void *);
+        // every coroutine is the echo handler of a connection
+        const size_t frameBytes = getConnections().empty() ? 0 : FramePool::inUse() / getConnections().size();
+        const size_t heapBytes = idle ? idleHeapBytes / idle : 0;
+
+        const IoCounters &io = IoOp::counters();
+        const auto perMb = [](const uint64_t calls, const uint64_t bytes)
+        { return bytes ? calls * 1024.0 * 1024.0 / bytes : 0.0; };
+
+        ostringstream oss;
+        oss << "Metrics: connections " << getConnections().size() << ", idle " << idle
+            << ", bytes per idle connection " << (idle ? connectionBytes + frameBytes + heapBytes : 0)
+            << " (connection " << connectionBytes << ", coroutine frame " << frameBytes << ", buffers " << heapBytes
+            << ")"
+            << ", shared overflow bytes " << getOverflow().size() << ", read syscalls per MB "
+            << perMb(io.reads, io.readBytes) << ", write syscalls per MB " << perMb(io.writes, io.writeBytes);
+        LOG_INFO(oss.str().c_str());
+    }
+
+    void handleSignals()
+    {
+        bool reload = false;
+        bool metrics = false;
+        struct signalfd_siginfo info;
+        while (sizeof(info) == read(*getSignals(), &info, sizeof(info)))
+        {
+            reload = reload || info.ssi_signo == SIGHUP;
+            metrics = metrics || info.ssi_signo == SIGUSR1;
+        }
+
+        if (reload)
+            reloadConfig();
+        if (metrics)
+            logMetrics();
     }
 
     [[maybe_unused]] string eventsToString(uint32_t events)
@@ -216,17 +930,94 @@ namespace
     }
 } // namespace
 
-int main()
+void printUsage()
 {
+    printf("server [--hot-restart] [--config file] [--setting value ...]\n");
+    printf("settings (default) [reloaded on SIGHUP]:\n");
+    for (const auto &line : ServerConfig::describe())
+        printf("  %s\n", line.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    bool hotRestart = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+        {
+            printUsage();
+            return 0;
+        }
+
+        if (!strcmp(argv[i], "--hot-restart"))
+            hotRestart = true;
+        else
+            getConfigArgs().push_back(argv[i]);
+    }
+
+    try
+    {
+        getConfig() = ServerConfig::load(getConfigArgs());
+    }
+    catch (const exception &e)
+    {
+        printf("%s\n", e.what());
+        printUsage();
+        return -1;
+    }
+
     LOG_DEBUG("Server starting");
 
-    if (!getEpoll().addNonblocking(getServerSocket(), SERVER_EVENTS))
+    getScheduler().onFinished(closeConnection);
+
+    // before anything is allocated so that first touch lands on the local node
+    if (getConfig().reactorCpu >= 0 && pinToCpu(getConfig().reactorCpu))
+        preferLocalNode();
+
+    getOverflow() = vector<char>(getConfig().bufferSize);
+
+    // whatever may fail goes before taking over, the running instance serves until then
+    try
+    {
+        getCapture();
+    }
+    catch (const exception &e)
+    {
+        LOG_ERROR("Failed to open capture file");
         return -1;
+    }
+
+    if (!listenForSignals())
+        LOG_ERROR("Failed to listen for SIGHUP, config will not be reloaded");
+
+    if (hotRestart)
+    {
+        if (!takeOver())
+            return -1;
+    }
+    else
+    {
+        getServerSocket() = createSocket();
+        if (!getServerSocket() || !getEpoll().addNonblocking(getServerSocket(), SERVER_EVENTS))
+            return -1;
+    }
+
+    // server keeps working without hot restart support
+    listenForHandoff();
 
-    struct epoll_event events[MAX_EVENTS] = {0};
+    vector<struct epoll_event> events(getConfig().maxEvents);
     while (1)
     {
-        const int num = epoll_wait(getEpoll(), events, _count_of(events), -1);
+        // do not block while some connections still have budgeted work to do
+        int timeout = getConfig().busyPoll ? 0 : getScheduler().timeout();
+        if (isDraining() && timeout != 0)
+        {
+            // wake up for the drain deadline even when nothing happens
+            const auto left = chrono::ceil<chrono::milliseconds>(getDrainDeadline() - Scheduler::Clock::now()).count();
+            const int deadline = static_cast<int>(std::clamp<decltype(left)>(left, 0, INT_MAX));
+            timeout = timeout < 0 ? deadline : min(timeout, deadline);
+        }
+        const int num = epoll_wait(getEpoll(), events.data(), events.size(), timeout);
         if (-1 == num)
         {
             LOG_ERROR("Failed to wait");
@@ -242,12 +1033,35 @@ int main()
                 if (!handleServerEvent(e.events))
                     break;
             }
+            else if (getHandoffSocket() && *getHandoffSocket() == e.data.fd)
+            {
+                handleHandoffRequest();
+            }
+            else if (getHandoffChannel() && *getHandoffChannel() == e.data.fd)
+            {
+                if (isHandingOff())
+                    handleHandoffReady();
+                else
+                    handleHandoffRecords();
+            }
+            else if (getSignals() && *getSignals() == e.data.fd)
+            {
+                handleSignals();
+            }
             else
             {
                 // client connection event
                 handleClientEvent(e.data.fd, e.events);
             }
         }
+
+        getScheduler().run();
+
+        if (getCapture())
+            getCapture()->flush();
+
+        if (isDraining() && drainConnections())
+            break;
     }
 
     LOG_DEBUG("Server finished");
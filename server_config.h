@@ -1,8 +1,8 @@
 #pragma once
 
-#define PORT 5000
-#define MAX_CONN 10
-#define MAX_EVENTS 5
-#define SERVER_BUFFEER_SIZE 10
-#define LOG_LEVEL Logger::Level::INFO
-#define LOG_FILE "server.log"
+// Everything else is configured at run time, see config/config.h and server --help
+
+// every 0-terminated message is followed by its CRC32C, must match client
+#ifndef INTEGRITY_CHECK
+#define INTEGRITY_CHECK 0
+#endif
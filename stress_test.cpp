@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <client/client.h>
+#include <logger/logger.h>
+
+#include "client_config.h"
+
+// Randomized long-running load against a running server: thousands of idle
+// connections with churn, messages up to tens of MB, abrupt disconnects in the
+// middle of a message and half-closed connections. Server RSS, threads and open
+// fds are sampled from /proc and must not keep growing: after a warm-up RSS may
+// not trend upward and may not stay above its warm-up peak once the load stops.
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr int IO_TIMEOUT_MS = 30 * 1000;
+    constexpr size_t WORKERS = 16;
+    // part of the run the server may spend reaching its working set
+    constexpr double WARM_UP = 1.0 / 3;
+    // RSS trend after warm-up, a leak of a few MB/s fails well above it
+    constexpr double MAX_RSS_SLOPE_KB = 256;
+    // RSS after the load stops over the warm-up peak, allocator slack
+    constexpr size_t RSS_TOLERANCE_KB = 8 * 1024;
+
+    Logger &getLogger()
+    {
+        static std::unique_ptr<Logger> l = LoggerFactory::getConsoleLogger(Logger::Level::ERROR);
+        return *l;
+    }
+
+    void fail(const char *what)
+    {
+        static std::mutex m;
+        std::lock_guard<std::mutex> lock(m);
+        printf("FAIL: %s\n", what);
+    }
+
+    // payload is never 0 so that it is not split into logged strings,
+    // every connection gets its own sequence to catch mixed up replies
+    char pattern(const uint32_t seed, const size_t i)
+    {
+        return static_cast<char>('a' + (seed + i * 7 + i / 26) % 26);
+    }
+
+    struct Options
+    {
+        // close before sending this many bytes, none if 0
+        size_t abortAfter = 0;
+        // shutdown writing after sending everything, server has to echo and close
+        bool halfClose = false;
+    };
+
+    // sends size bytes and checks the echo while sending, the server does not buffer everything
+    bool exchange(const int fd, const size_t size, const uint32_t seed, const Options &options)
+    {
+        if (-1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK))
+            return false;
+
+        std::vector<char> out(64 * 1024);
+        std::vector<char> in(64 * 1024);
+        size_t sent = 0;
+        size_t received = 0;
+        bool shut = false;
+
+        while (received < size || (options.halfClose && !shut))
+        {
+            if (options.abortAfter && sent >= options.abortAfter)
+                return true;
+
+            if (options.halfClose && sent == size && !shut)
+            {
+                if (-1 == shutdown(fd, SHUT_WR))
+                    return false;
+                shut = true;
+                continue;
+            }
+
+            struct pollfd p{fd, static_cast<short>(POLLIN | (sent < size ? POLLOUT : 0)), 0};
+            const int num = poll(&p, 1, IO_TIMEOUT_MS);
+            if (num <= 0)
+            {
+                fail("no reply from server");
+                return false;
+            }
+
+            if (p.revents & POLLOUT)
+            {
+                size_t chunk = std::min(out.size(), size - sent);
+                if (options.abortAfter)
+                    chunk = std::min(chunk, options.abortAfter - sent);
+
+                for (size_t i = 0; i < chunk; ++i)
+                    out[i] = pattern(seed, sent + i);
+
+                const ssize_t w = send(fd, out.data(), chunk, MSG_NOSIGNAL);
+                if (-1 == w && errno != EAGAIN)
+                {
+                    fail("failed to send");
+                    return false;
+                }
+                sent += std::max<ssize_t>(w, 0);
+            }
+
+            if (p.revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                const ssize_t r = read(fd, in.data(), in.size());
+                if (-1 == r && errno == EAGAIN)
+                    continue;
+
+                if (r <= 0)
+                {
+                    fail("connection closed before whole echo");
+                    return false;
+                }
+
+                for (ssize_t i = 0; i < r; ++i)
+                {
+                    if (received + i >= size || in[i] != pattern(seed, received + i))
+                    {
+                        fail("reply mismatch");
+                        return false;
+                    }
+                }
+                received += r;
+            }
+        }
+
+        if (!options.halfClose)
+            return true;
+
+        // everything echoed, server must close its side as well
+        struct pollfd p{fd, POLLIN, 0};
+        char c;
+        if (poll(&p, 1, IO_TIMEOUT_MS) <= 0 || 0 != read(fd, &c, 1))
+        {
+            fail("half-closed connection was not closed by server");
+            return false;
+        }
+
+        return true;
+    }
+
+    std::unique_ptr<Client> connect()
+    {
+        auto cl = std::make_unique<Client>(getLogger());
+        if (!cl->connect(PORT))
+        {
+            fail("failed to connect");
+            return nullptr;
+        }
+
+        return cl;
+    }
+
+    // mostly small messages, log-uniform up to maxSize
+    size_t randomSize(std::mt19937 &rng, const size_t maxSize)
+    {
+        std::uniform_real_distribution<double> exponent(0, std::log2(static_cast<double>(maxSize)));
+        return std::max<size_t>(1, static_cast<size_t>(std::exp2(exponent(rng))));
+    }
+
+    struct Stats
+    {
+        std::atomic<size_t> echoes{0};
+        std::atomic<size_t> aborts{0};
+        std::atomic<size_t> halfCloses{0};
+        std::atomic<size_t> pings{0};
+        std::atomic<size_t> reconnects{0};
+        std::atomic<size_t> bytes{0};
+    };
+
+    bool worker(const size_t id, const Clock::time_point deadline, const size_t idleConnections,
+                const size_t maxSize, Stats &stats)
+    {
+        std::mt19937 rng(static_cast<uint32_t>(id * 7919 + 1));
+
+        // idle connections owned by this worker, opened along the way, pinged and replaced at random
+        std::vector<std::unique_ptr<Client>> idle;
+        while (Clock::now() < deadline)
+        {
+            if (idle.size() < idleConnections)
+            {
+                idle.push_back(connect());
+                if (!idle.back())
+                    return false;
+            }
+
+            const uint32_t seed = rng();
+            const int action = std::uniform_int_distribution<int>(0, 99)(rng);
+            if (action < 40 && !idle.empty())
+            {
+                auto &cl = idle[rng() % idle.size()];
+                if (action < 10)
+                {
+                    // churn: server gets the same fd numbers again and again
+                    cl = connect();
+                    if (!cl)
+                        return false;
+                    ++stats.reconnects;
+                }
+
+                const size_t size = 1 + rng() % 256;
+                if (!exchange(*cl, size, seed, {}))
+                    return false;
+                ++stats.pings;
+                stats.bytes += size;
+                continue;
+            }
+
+            std::unique_ptr<Client> cl = connect();
+            if (!cl)
+                return false;
+
+            const size_t size = randomSize(rng, maxSize);
+            Options options;
+            if (action < 55)
+            {
+                options.abortAfter = 1 + rng() % size;
+                if (rng() % 2)
+                {
+                    // reset instead of orderly close
+                    struct linger l{1, 0};
+                    setsockopt(*cl, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+                }
+                ++stats.aborts;
+            }
+            else if (action < 70)
+            {
+                options.halfClose = true;
+                ++stats.halfCloses;
+            }
+            else
+            {
+                ++stats.echoes;
+            }
+
+            if (!exchange(*cl, size, seed, options))
+                return false;
+            stats.bytes += options.abortAfter ? options.abortAfter : size;
+        }
+
+        return true;
+    }
+
+    struct Sample
+    {
+        double seconds = 0;
+        size_t rssKb = 0;
+        size_t threads = 0;
+        size_t fds = 0;
+    };
+
+    bool sample(const int pid, const Clock::time_point start, Sample &s)
+    {
+        s.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+        if (!status.is_open())
+            return false;
+
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (0 == line.compare(0, 6, "VmRSS:"))
+                s.rssKb = strtoul(line.c_str() + 6, nullptr, 10);
+            else if (0 == line.compare(0, 8, "Threads:"))
+                s.threads = strtoul(line.c_str() + 8, nullptr, 10);
+        }
+
+        DIR *dir = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+        if (nullptr == dir)
+            return false;
+
+        s.fds = 0;
+        while (const struct dirent *e = readdir(dir))
+        {
+            if (e->d_name[0] != '.')
+                ++s.fds;
+        }
+        closedir(dir);
+
+        return true;
+    }
+
+    // least squares slope of RSS over samples taken from the given second, kB/s
+    double rssSlope(const std::vector<Sample> &samples, const double from)
+    {
+        double n = 0;
+        double sumT = 0;
+        double sumR = 0;
+        double sumTT = 0;
+        double sumTR = 0;
+        for (const auto &s : samples)
+        {
+            if (s.seconds < from)
+                continue;
+
+            n += 1;
+            sumT += s.seconds;
+            sumR += s.rssKb;
+            sumTT += s.seconds * s.seconds;
+            sumTR += s.seconds * s.rssKb;
+        }
+
+        const double d = n * sumTT - sumT * sumT;
+        return n < 3 || d <= 0 ? 0 : (n * sumTR - sumT * sumR) / d;
+    }
+
+    void printSample(const char *label, const Sample &s)
+    {
+        printf("%-8s %7.1f s  rss %8zu kB  threads %4zu  fds %6zu\n", label, s.seconds, s.rssKb, s.threads, s.fds);
+        fflush(stdout);
+    }
+
+    void printUsage()
+    {
+        printf("stress_test server_pid [seconds] [idle connections] [max message MB]\n");
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 5)
+    {
+        printUsage();
+        return -1;
+    }
+
+    const int pid = atoi(argv[1]);
+    const size_t seconds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 30;
+    const size_t connections = argc > 3 ? strtoul(argv[3], nullptr, 10) : 2000;
+    const size_t maxSize = (argc > 4 ? strtoul(argv[4], nullptr, 10) : 16) * 1024 * 1024;
+
+    // thousands of connections on our side as well
+    struct rlimit limit{};
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const auto start = Clock::now();
+    Sample initial;
+    if (!sample(pid, start, initial))
+    {
+        printf("FAIL: no such server process %d\n", pid);
+        return -1;
+    }
+    printSample("initial", initial);
+
+    Stats stats;
+    std::atomic<bool> result{true};
+    std::atomic<bool> running{true};
+    const auto deadline = start + std::chrono::seconds(seconds);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < WORKERS; ++i)
+    {
+        workers.emplace_back([&, i]()
+                             {
+                                 if (!worker(i, deadline, connections / WORKERS, maxSize, stats))
+                                     result = false;
+                             });
+    }
+
+    // sampled once a second until workers are done
+    std::vector<Sample> samples;
+    std::thread sampler([&]()
+                        {
+                            while (running)
+                            {
+                                Sample s;
+                                if (!sample(pid, start, s))
+                                {
+                                    fail("server is gone");
+                                    result = false;
+                                    return;
+                                }
+                                samples.push_back(s);
+                                printSample("sample", s);
+                                std::this_thread::sleep_for(std::chrono::seconds(1));
+                            }
+                        });
+
+    for (auto &w : workers)
+        w.join();
+    running = false;
+    sampler.join();
+
+    // all our connections are closed now, let the server notice
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    Sample final;
+    if (!sample(pid, start, final))
+    {
+        fail("server is gone");
+        return -1;
+    }
+    printSample("final", final);
+
+    printf("echoes %zu, pings %zu, reconnects %zu, aborted %zu, half-closed %zu, %.1f MB\n",
+           stats.echoes.load(), stats.pings.load(), stats.reconnects.load(), stats.aborts.load(),
+           stats.halfCloses.load(), static_cast<double>(stats.bytes) / (1024 * 1024));
+
+    Sample peak = initial;
+    for (const auto &s : samples)
+        peak.threads = std::max(peak.threads, s.threads);
+
+    // memory may stay at its high-water mark but must not keep climbing
+    const double warmUp = seconds * WARM_UP;
+    size_t warmUpRss = initial.rssKb;
+    for (const auto &s : samples)
+    {
+        if (s.seconds < warmUp)
+            warmUpRss = std::max(warmUpRss, s.rssKb);
+    }
+    const double slope = rssSlope(samples, warmUp);
+    printf("rss after warm-up: %.1f kB/s, %zu kB at warm-up peak\n", slope, warmUpRss);
+
+    if (0 == stats.pings + stats.echoes + stats.aborts + stats.halfCloses)
+    {
+        fail("no traffic went through");
+        result = false;
+    }
+
+    if (final.fds > initial.fds)
+    {
+        fail("server leaks file descriptors");
+        result = false;
+    }
+
+    if (peak.threads > initial.threads)
+    {
+        fail("server starts threads per connection");
+        result = false;
+    }
+
+    if (slope > MAX_RSS_SLOPE_KB || final.rssKb > warmUpRss + RSS_TOLERANCE_KB)
+    {
+        fail("server memory keeps growing");
+        result = false;
+    }
+
+    printf("%s\n", result ? "SUCCESS" : "FAIL");
+    return result ? 0 : -1;
+}
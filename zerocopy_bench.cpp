@@ -0,0 +1,268 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <helpers/helpers.hpp>
+#include <helpers/zerocopy.hpp>
+
+// Streams messages of growing size with plain send and with MSG_ZEROCOPY and
+// compares throughput and CPU time of the sending thread, to find the message
+// size from which zero-copy pays off. Without sink address data goes to a
+// local thread over loopback, where the kernel copies zero-copy sends anyway.
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // zero-copy sends waiting for completion before the sender waits for the kernel
+    constexpr size_t MAX_INFLIGHT = 256;
+
+    struct Result
+    {
+        double mbPerSecond = 0;
+        // CPU time of the sending thread
+        double cpuUsPerMb = 0;
+        double copiedPercent = 0;
+    };
+
+    double threadCpuUs()
+    {
+        struct rusage u{};
+        getrusage(RUSAGE_THREAD, &u);
+        return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1e6 + u.ru_utime.tv_usec + u.ru_stime.tv_usec;
+    }
+
+    // waits for errors queue and reads completions, false on error or timeout
+    bool waitForCompletions(const int fd, ZeroCopy &zeroCopy, const int timeoutMs)
+    {
+        struct pollfd p{fd, 0, 0};
+        if (poll(&p, 1, timeoutMs) <= 0 || !(p.revents & POLLERR))
+            return false;
+
+        return zeroCopy.reap(fd);
+    }
+
+    bool sendAll(const int fd, const char *data, size_t size, const int flags)
+    {
+        while (size > 0)
+        {
+            const ssize_t num = send(fd, data, size, flags);
+            if (-1 == num)
+                return false;
+
+            data += num;
+            size -= num;
+        }
+
+        return true;
+    }
+
+    bool run(const sockaddr_in &sink, const std::vector<char> &msg, const bool zeroCopy, const double seconds, Result &result)
+    {
+        Socket s(AF_INET, SOCK_STREAM, 0);
+        if (-1 == connect(s, reinterpret_cast<const struct sockaddr *>(&sink), sizeof(sink)))
+        {
+            printf("Failed to connect to sink\n");
+            return false;
+        }
+
+        ZeroCopy tracker;
+        if (zeroCopy && !tracker.enable(s))
+        {
+            printf("SO_ZEROCOPY is not supported\n");
+            return false;
+        }
+
+        size_t bytes = 0;
+        const double cpuStart = threadCpuUs();
+        const auto start = Clock::now();
+        const auto deadline = start + std::chrono::duration<double>(seconds);
+        while (Clock::now() < deadline)
+        {
+            if (!zeroCopy)
+            {
+                if (!sendAll(s, msg.data(), msg.size(), MSG_NOSIGNAL))
+                    return false;
+
+                bytes += msg.size();
+                continue;
+            }
+
+            // message never changes, buffers are tracked only to bound sends in flight
+            while (tracker.pinned() >= MAX_INFLIGHT)
+            {
+                if (!waitForCompletions(s, tracker, 1000))
+                    return false;
+            }
+
+            ZeroCopy::Pinned &pinned = tracker.pin({});
+            const ssize_t num = send(s, msg.data(), msg.size(), MSG_NOSIGNAL | MSG_ZEROCOPY);
+            if (-1 == num && errno == ENOBUFS)
+            {
+                // too many pages pinned, wait for the kernel
+                tracker.seal(pinned);
+                if (!waitForCompletions(s, tracker, 1000))
+                    return false;
+                continue;
+            }
+
+            if (-1 == num)
+                return false;
+
+            ++pinned.sends;
+            tracker.seal(pinned);
+            if (static_cast<size_t>(num) < msg.size() &&
+                !sendAll(s, msg.data() + num, msg.size() - num, MSG_NOSIGNAL))
+                return false;
+
+            // remainder of a partial send is copied but counts like in the copy run
+            bytes += msg.size();
+        }
+
+        while (tracker.pinned() > 0)
+        {
+            if (!waitForCompletions(s, tracker, 1000))
+            {
+                printf("Zero-copy completions are missing\n");
+                return false;
+            }
+        }
+
+        const double cpuUs = threadCpuUs() - cpuStart;
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        const double mb = static_cast<double>(bytes) / (1024 * 1024);
+        result.mbPerSecond = mb / elapsed.count();
+        result.cpuUsPerMb = cpuUs / mb;
+        result.copiedPercent = tracker.completed() ? 100.0 * tracker.copied() / tracker.completed() : 0;
+        return true;
+    }
+
+    // reads and drops everything sent to it, one connection at a time
+    void discard(const int server, const std::atomic<bool> &stop)
+    {
+        std::vector<char> buffer(1024 * 1024);
+        while (!stop)
+        {
+            const int fd = accept(server, nullptr, nullptr);
+            if (-1 == fd)
+                return;
+
+            FD client(fd);
+            while (read(client, buffer.data(), buffer.size()) > 0)
+                ;
+        }
+    }
+
+    void printUsage()
+    {
+        printf("zerocopy_bench [seconds per size] [sink ip] [sink port]\n");
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 4 || (argc == 2 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))))
+    {
+        printUsage();
+        return argc > 4 ? -1 : 0;
+    }
+
+    const double seconds = argc > 1 ? atof(argv[1]) : 1;
+    if (seconds <= 0 || argc == 3)
+    {
+        printUsage();
+        return -1;
+    }
+
+    sockaddr_in sink{};
+    sink.sin_family = AF_INET;
+
+    // local sink on loopback unless a remote one is given
+    Socket server(AF_INET, SOCK_STREAM, 0);
+    std::atomic<bool> stop{false};
+    std::thread sinkThread;
+    if (argc > 3)
+    {
+        if (1 != inet_pton(AF_INET, argv[2], &sink.sin_addr))
+        {
+            printUsage();
+            return -1;
+        }
+        sink.sin_port = htons(atoi(argv[3]));
+    }
+    else
+    {
+        sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(sink);
+        if (-1 == bind(server, reinterpret_cast<struct sockaddr *>(&sink), sizeof(sink)) ||
+            -1 == listen(server, 1) ||
+            -1 == getsockname(server, reinterpret_cast<struct sockaddr *>(&sink), &length))
+        {
+            printf("Failed to start local sink\n");
+            return -1;
+        }
+
+        sinkThread = std::thread(discard, static_cast<int>(server), std::cref(stop));
+    }
+
+    const size_t sizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+    size_t crossover = 0;
+    // sizes where the kernel really sent without copying
+    size_t measured = 0;
+    bool result = true;
+
+    printf("%10s  %12s %12s  %12s %12s %8s\n", "bytes", "copy MB/s", "copy us/MB", "zc MB/s", "zc us/MB", "copied");
+    for (const size_t size : sizes)
+    {
+        const std::vector<char> msg(size, 'z');
+        Result copy;
+        Result zeroCopy;
+        if (!run(sink, msg, false, seconds, copy) || !run(sink, msg, true, seconds, zeroCopy))
+        {
+            result = false;
+            break;
+        }
+
+        printf("%10zu  %12.1f %12.1f  %12.1f %12.1f %7.0f%%\n", size, copy.mbPerSecond, copy.cpuUsPerMb,
+               zeroCopy.mbPerSecond, zeroCopy.cpuUsPerMb, zeroCopy.copiedPercent);
+
+        // a copied zero-copy send is just a slower copy, comparing it says nothing
+        if (zeroCopy.copiedPercent > 0)
+            continue;
+
+        ++measured;
+        if (!crossover && zeroCopy.cpuUsPerMb < copy.cpuUsPerMb)
+            crossover = size;
+    }
+
+    if (result)
+    {
+        if (!measured)
+            printf("kernel copied zero-copy sends, zero-copy cannot be measured on this path\n");
+        else if (crossover)
+            printf("zero-copy uses less CPU from %zu bytes\n", crossover);
+        else
+            printf("zero-copy does not pay off for these sizes\n");
+    }
+
+    stop = true;
+    if (sinkThread.joinable())
+    {
+        // wake up accept
+        shutdown(server, SHUT_RDWR);
+        sinkThread.join();
+    }
+
+    return result ? 0 : -1;
+}